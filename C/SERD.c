@@ -2,7 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <omp.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
 
 /******* sincos ******
 * sincos[0] = sin a  *
@@ -11,524 +19,2972 @@
 * sincos[3] = cos b  *
 *********************/
 
-/* Grid initialization */
+/* Sparse brick-map grid */
 
 /*
- * Function: igrid
- * ---------------
- * 
- * Fill integer grid with 1
+ * Brick-map layout
+ * ----------------
  * 
- * grid: empty 3D grid
- * size: number of voxels
+ * The 3D grid is split into bricks of 8 x 8 x 8 voxels. A brick is either
+ * uniform, when all its voxels share one label and no storage is allocated,
+ * or allocated, when its 512 voxels are stored in a slot of the brick pool.
+ * Bricks are allocated on the first write of a label that differs from the
+ * uniform label, so memory scales with the biomolecule and its surface shell
+ * instead of the bounding box. The brick pool grows in chunks of 4096 bricks
+ * (2 MB), taken from the heap or memory-mapped (anonymous or from a scratch
+ * file). Voxel (i, j, k) is stored in brick (i / 8, j / 8, k / 8) at offset
+ * (k % 8) + 8 * ((j % 8) + 8 * (i % 8)).
  * 
  */
-void igrid(int *grid, int size)
-{
-    int i;
-
-    for (i = 0; i < size; i++)
-        grid[i] = 1;
-}
-
-/* Grid filling */
+#define BRICK 8
+#define BRICK_SHIFT 3
+#define BRICK_MASK 7
+#define BRICK_VOXELS 512
+#define CHUNK_SHIFT 12
+#define CHUNK_BRICKS 4096
+#define CHUNK_SIZE ((size_t)CHUNK_BRICKS * BRICK_VOXELS)
+#define UNIFORM -1
+#define HEAP_POOL -2
+#define ANONYMOUS_POOL -1
+
+/* Huge pages */
+#define HUGE_PAGE ((size_t)2 << 20)
+
+/* NUMA placement policies */
+#define FIRST_TOUCH 0
+#define INTERLEAVE 1
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+#define BRICK_INDEX(grid, i, j, k) (((((i) >> BRICK_SHIFT) * (grid)->by) + ((j) >> BRICK_SHIFT)) * (grid)->bz + ((k) >> BRICK_SHIFT))
+#define BRICK_OFFSET(i, j, k) (((k) & BRICK_MASK) + BRICK * (((j) & BRICK_MASK) + BRICK * ((i) & BRICK_MASK)))
+#define SLOT_VOXELS(grid, s) ((grid)->chunks[(s) >> CHUNK_SHIFT] + (size_t)((s) & (CHUNK_BRICKS - 1)) * BRICK_VOXELS)
 
 /*
- * Function: fill
- * --------------
+ * Struct: brickmap
+ * ----------------
  * 
- * Insert atoms with a probe addition inside a 3D grid
+ * A sparse 3D grid of narrow labels stored in bricks
  * 
- * grid: 3D grid
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
- * atoms: xyz coordinates and radii of input pdb
- * natoms: number of atoms
- * xyzr: number of data per atom (4: xyzr)
- * reference: xyz coordinates of 3D grid origin
- * ndims: number of coordinates (3: xyz)
- * sincos: sin and cos of 3D grid angles
- * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
- * step: 3D grid spacing (A)
- * probe: Probe size (A)
- * nthreads: number of threads for OpenMP
+ * bx: x brick units
+ * by: y brick units
+ * bz: z brick units
+ * nbricks: number of bricks
+ * uniform: label of each brick while it is not allocated
+ * slot: pool slot of each brick (UNIFORM: not allocated)
+ * chunks: brick pool chunks
+ * nslots: number of allocated bricks
+ * pool: brick pool backing (HEAP_POOL, ANONYMOUS_POOL or scratch file descriptor)
+ * fallback: first chunk on the heap after the pool backing failed (-1: none)
+ * capacity: number of bricks of uniform and slot arrays
+ * nchunks: number of brick pool chunks
+ * placement: NUMA placement policy of new memory (FIRST_TOUCH or INTERLEAVE)
  * 
  */
-void fill(int *grid, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads)
+typedef struct brickmap
 {
-    int i, j, k, atom;
-    double x, y, z, xaux, yaux, zaux, distance, H;
-
-    // Set number of processes in OpenMP
-    omp_set_num_threads(nthreads);
-    omp_set_nested(1);
+    int nx;
+    int ny;
+    int nz;
+    int bx;
+    int by;
+    int bz;
+    int nbricks;
+    signed char *uniform;
+    int *slot;
+    signed char **chunks;
+    int nslots;
+    int pool;
+    int fallback;
+    int capacity;
+    int nchunks;
+    int placement;
+} brickmap;
 
-#pragma omp parallel default(none), shared(grid, reference, step, probe, natoms, nx, ny, nz, sincos, atoms, nthreads), private(atom, i, j, k, distance, H, x, y, z, xaux, yaux, zaux)
-    {
-#pragma omp for schedule(dynamic)
-        for (atom = 0; atom < natoms; atom++)
-        {
-            // Convert atom coordinates in 3D grid coordinates
-            x = (atoms[atom * 4] - reference[0]) / step;
-            y = (atoms[1 + (atom * 4)] - reference[1]) / step;
-            z = (atoms[2 + (atom * 4)] - reference[2]) / step;
+/* Grid initialization */
 
-            xaux = x * sincos[3] + z * sincos[2];
-            yaux = y;
-            zaux = (-x) * sincos[2] + z * sincos[3];
+/*
+ * Function: huge_alloc
+ * --------------------
+ * 
+ * Allocate memory aligned to 2 MB with transparent huge page advice, so
+ * large strided accesses need fewer TLB entries. Allocations smaller than
+ * a huge page use malloc. Memory is released with free.
+ * 
+ * length: length of memory (bytes)
+ * 
+ * returns: memory
+ */
+void *huge_alloc(size_t length)
+{
+    void *memory;
 
-            x = xaux;
-            y = yaux * sincos[1] - zaux * sincos[0];
-            z = yaux * sincos[0] + zaux * sincos[1];
+    if (length < HUGE_PAGE)
+        return malloc(length);
 
-            // Create a radius (H) for space occupied by probe and atom
-            H = (probe + atoms[3 + (atom * 4)]) / step;
+    // Round up to whole huge pages
+    length = (length + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    if (posix_memalign(&memory, HUGE_PAGE, length) != 0)
+        return malloc(length);
+#ifdef MADV_HUGEPAGE
+    madvise(memory, length, MADV_HUGEPAGE);
+#endif
 
-            // Loop around radius from atom center
-            for (i = floor(x - H); i <= ceil(x + H); i++)
-                for (j = floor(y - H); j <= ceil(y + H); j++)
-                    for (k = floor(z - H); k <= ceil(z + H); k++)
-                    {
-                        // Get distance between atom center and point inspected
-                        distance = sqrt(pow(i - x, 2) + pow(j - y, 2) + pow(k - z, 2));
-                        if (distance < H)
-                            if (i >= 0 && i < nx && j >= 0 && j < ny && k >= 0 && k < nz)
-                                grid[k + nz * (j + (ny * i))] = 0;
-                    }
-        }
-    }
+    return memory;
 }
 
-/* Biomolecular surface representation */
-
 /*
- * Function: check_protein_neighbours
- * ----------------------------------
+ * Function: place_memory
+ * ----------------------
  * 
- * Checks if a cavity point on the grid is next to a protein point (0 or -2)
+ * Apply NUMA placement policy to a memory range that is not touched yet.
+ * With FIRST_TOUCH, pages are placed on the node of the thread that first
+ * writes them, so kernels with the same static partitioning use local
+ * memory. With INTERLEAVE, pages are spread round-robin over all nodes.
+ * Only ranges of at least one huge page that start on a page boundary are
+ * placed, i.e. huge_alloc buffers and mapped pool chunks. Smaller ranges
+ * come from malloc and may share pages with unrelated heap data.
  * 
- * grid: 3D grid
- * dx: x grid units
- * dy: y grid units
- * dz: z grid units
- * i: x coordinate of cavity point
- * j: y coordinate of cavity point
- * k: z coordinate of cavity point
+ * memory: memory range
+ * length: length of memory range (bytes)
+ * placement: NUMA placement policy (FIRST_TOUCH or INTERLEAVE)
  * 
- * returns: true (int 1) or false (int 0)
  */
-int check_protein_neighbours(int *grid, int nx, int ny, int nz, int i, int j, int k)
+void place_memory(void *memory, size_t length, int placement)
 {
-    int x, y, z;
+#ifdef SYS_mbind
+    unsigned long nodemask = ~0UL;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
 
-    // Loop around neighboring points
-    for (x = i - 1; x <= i + 1; x++)
-        for (y = j - 1; y <= j + 1; y++)
-            for (z = k - 1; z <= k + 1; z++)
-            {
-                // Check if point is inside 3D grid
-                if (x < 0 || y < 0 || z < 0 || x > nx - 1 || y > ny - 1 || z > nz - 1)
-                    ;
-                else if (grid[z + nz * (y + (ny * x))] == 0 || grid[z + nz * (y + (ny * x))] == -2)
-                    return 1;
-            }
-    return 0;
+    if (placement != INTERLEAVE || length < HUGE_PAGE || (size_t)memory % page != 0)
+        return;
+
+    // Only whole pages inside memory range
+    syscall(SYS_mbind, memory, length / page * page, MPOL_INTERLEAVE, &nodemask, sizeof(nodemask) * 8, 0);
+#endif
 }
 
 /*
- * Function: ses
- * --------------
+ * Function: resize_grid
+ * ---------------------
  * 
- * Adjust surface representation to Solvent Excluded Surface (SES)
+ * Reinitialize brick map with uniform bricks of 1 for new grid dimensions.
+ * Arrays only grow and allocated pool chunks are kept for the next bricks.
+ * Arrays are initialized in parallel with the static brick partitioning of
+ * the kernels, so pages are first touched by the threads that use them.
  * 
- * grid: 3D grid
+ * grid: brick map
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
- * step: 3D grid spacing (A)
- * probe: Probe size (A)
  * nthreads: number of threads for OpenMP
  * 
  */
-void ses(int *grid, int nx, int ny, int nz, double step, double probe, int nthreads)
+void resize_grid(brickmap *grid, int nx, int ny, int nz, int nthreads)
 {
-    int i, j, k, i2, j2, k2, aux;
-    double distance;
+    int b, nchunks;
+
+    grid->nx = nx;
+    grid->ny = ny;
+    grid->nz = nz;
+    grid->bx = (nx + BRICK_MASK) >> BRICK_SHIFT;
+    grid->by = (ny + BRICK_MASK) >> BRICK_SHIFT;
+    grid->bz = (nz + BRICK_MASK) >> BRICK_SHIFT;
+    grid->nbricks = grid->bx * grid->by * grid->bz;
+    grid->nslots = 0;
+
+    if (grid->nbricks > grid->capacity)
+    {
+        grid->capacity = grid->nbricks;
+        free(grid->uniform);
+        free(grid->slot);
+        grid->uniform = (signed char *)huge_alloc(grid->capacity * sizeof(signed char));
+        grid->slot = (int *)huge_alloc(grid->capacity * sizeof(int));
+        place_memory(grid->uniform, grid->capacity * sizeof(signed char), grid->placement);
+        place_memory(grid->slot, grid->capacity * sizeof(int), grid->placement);
+    }
 
-    // Calculate sas limit in 3D grid units
-    aux = ceil(probe / step);
+    nchunks = (grid->nbricks >> CHUNK_SHIFT) + 1;
+    if (nchunks > grid->nchunks)
+    {
+        grid->chunks = (signed char **)realloc(grid->chunks, nchunks * sizeof(signed char *));
+        memset(grid->chunks + grid->nchunks, 0, (nchunks - grid->nchunks) * sizeof(signed char *));
+        grid->nchunks = nchunks;
+    }
 
-    // Set number of processes in OpenMP
+    // Set number of threads in OpenMP
     omp_set_num_threads(nthreads);
     omp_set_nested(1);
 
-#pragma omp parallel default(none), shared(grid, step, probe, aux, nx, ny, nz), private(i, j, k, i2, j2, k2, distance)
+#pragma omp parallel default(none), shared(grid), private(b)
     {
-#pragma omp for schedule(dynamic) collapse(3)
-        // Loop around 3D grid
-        for (i = 0; i < nx; i++)
-            for (j = 0; j < ny; j++)
-                for (k = 0; k < nz; k++)
-                {
-                    // Check if a cavity point
-                    if (grid[k + nz * (j + (ny * i))] == 1)
-                        if (check_protein_neighbours(grid, nx, ny, nz, i, j, k))
-                        {
-                            // Loop around sas limit from cavity point next to protein point
-                            for (i2 = i - aux; i2 <= i + aux; i2++)
-                                for (j2 = j - aux; j2 <= j + aux; j2++)
-                                    for (k2 = k - aux; k2 <= k + aux; k2++)
-                                    {
-                                        if (i2 > 0 && j2 > 0 && k2 > 0 && i2 < nx && j2 < ny && k2 < nz)
-                                        {
-                                            // Get distance between point inspected and cavity point
-                                            distance = sqrt(pow(i - i2, 2) + pow(j - j2, 2) + pow(k - k2, 2));
-                                            // Check if inspected point is inside sas limit
-                                            if (distance < (probe / step))
-                                                if (grid[k2 + nz * (j2 + (ny * i2))] == 0)
-                                                    // Mark cavity point
-                                                    grid[k2 + nz * (j2 + (ny * i2))] = -2;
-                                        }
-                                    }
-                        }
-                }
-
-#pragma omp for collapse(3)
-        // Loop around 3D grid
-        for (i = 0; i < nx; i++)
-            for (j = 0; j < ny; j++)
-                for (k = 0; k < nz; k++)
-                {
-                    // Mark space occupied by sas limit from protein surface
-                    if (grid[k + nz * (j + (ny * i))] == -2)
-                        grid[k + nz * (j + (ny * i))] = 1;
-                }
+#pragma omp for schedule(static)
+        for (b = 0; b < grid->nbricks; b++)
+        {
+            grid->uniform[b] = 1;
+            grid->slot[b] = UNIFORM;
+        }
     }
 }
 
-/* Surface points detection */
-
 /*
- * Function: define_surface_points
- * -------------------------------
+ * Function: igrid
+ * ---------------
  * 
- * Identify surface points based on neighboring points
+ * Initialize brick map with uniform bricks of 1
  * 
- * grid: 3D grid
+ * grid: brick map
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
- * i: x coordinate of point
- * j: y coordinate of point
- * k: z coordinate of point
+ * placement: NUMA placement policy (FIRST_TOUCH or INTERLEAVE)
+ * nthreads: number of threads for OpenMP
  * 
- * returns: surface point (1) or solvent point (-1)
  */
-int define_surface_points(int *grid, int nx, int ny, int nz, int i, int j, int k)
+void igrid(brickmap *grid, int nx, int ny, int nz, int placement, int nthreads)
 {
-    int x, y, z;
+    grid->uniform = NULL;
+    grid->slot = NULL;
+    grid->chunks = NULL;
+    grid->pool = HEAP_POOL;
+    grid->fallback = -1;
+    grid->capacity = 0;
+    grid->nchunks = 0;
+    grid->placement = placement;
+
+    resize_grid(grid, nx, ny, nz, nthreads);
+}
 
-    // Loop around neighboring points
-    for (x = i - 1; x <= i + 1; x++)
-        for (y = j - 1; y <= j + 1; y++)
-            for (z = k - 1; z <= k + 1; z++)
-            {
-                // Check if point is inside 3D grid
-                if (x < 0 || y < 0 || z < 0 || x > nx - 1 || y > ny - 1 || z > nz - 1)
-                    ;
-                else if (grid[z + nz * (y + (ny * x))] == 0)
-                    return 1;
-            }
+/*
+ * Function: map_grid
+ * ------------------
+ * 
+ * Back brick pool of an empty brick map with memory-mapped chunks, so the
+ * operating system can page bricks out of RAM
+ * 
+ * grid: brick map
+ * scratch: directory of an unlinked scratch file backing the chunks (NULL or
+ * empty: anonymous memory)
+ * 
+ */
+void map_grid(brickmap *grid, char *scratch)
+{
+    char *fn;
+
+    grid->pool = ANONYMOUS_POOL;
+    if (scratch == NULL || *scratch == '\0')
+        return;
 
-    return -1;
+    // Create scratch file, removed from directory as soon as it is opened
+    fn = (char *)malloc(strlen(scratch) + 20);
+    sprintf(fn, "%s/SERD-XXXXXX", scratch);
+    grid->pool = mkstemp(fn);
+    if (grid->pool < 0)
+    {
+        fprintf(stderr, "Warning: Unable to create scratch file in %s. Using anonymous memory.\n", scratch);
+        grid->pool = ANONYMOUS_POOL;
+    }
+    else
+        unlink(fn);
+    free(fn);
 }
 
 /*
- * Function: filter_surface
+ * Function: allocate_chunk
  * ------------------------
  * 
- * Inspect 3D grid and mark detected surface points on a surface 3D grid
+ * Allocate a brick pool chunk from the brick pool backing. Heap and anonymous
+ * chunks are aligned to a huge page. Once the backing fails to map a chunk,
+ * this chunk and the next ones are allocated on the heap, while the chunks
+ * already mapped stay in the backing.
  * 
- * grid: 3D grid
- * surface: surface points 3D grid
- * nx: x grid units
- * ny: y grid units
- * nz: z grid units
- * nthreads: number of threads for OpenMP
+ * grid: brick map
+ * c: chunk index
  * 
+ * returns: chunk storage
  */
-void filter_surface(int *grid, int nx, int ny, int nz, int nthreads)
+signed char *allocate_chunk(brickmap *grid, int c)
 {
-    int i, j, k;
+    void *chunk;
+    size_t head;
 
-    // Set number of threads in OpenMP
-    omp_set_num_threads(nthreads);
-    omp_set_nested(1);
+    if (grid->pool == HEAP_POOL || (grid->fallback >= 0 && c >= grid->fallback))
+    {
+        chunk = huge_alloc(CHUNK_SIZE);
+        place_memory(chunk, CHUNK_SIZE, grid->placement);
+        return (signed char *)chunk;
+    }
 
-#pragma omp parallel default(none), shared(grid, nx, ny, nz), private(i, j, k)
+    if (grid->pool == ANONYMOUS_POOL)
     {
-#pragma omp for collapse(3) schedule(static)
-        for (i = 0; i < nx; i++)
-            for (j = 0; j < ny; j++)
-                for (k = 0; k < nz; k++)
-                    if (grid[k + nz * (j + (ny * i))] == 1)
-                        // Define surface cavity points
-                        grid[k + nz * (j + (ny * i))] = define_surface_points(grid, nx, ny, nz, i, j, k);
+        // Map twice the chunk size and trim it to a huge page boundary
+        chunk = mmap(NULL, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (chunk != MAP_FAILED)
+        {
+            head = (HUGE_PAGE - (size_t)chunk % HUGE_PAGE) % HUGE_PAGE;
+            if (head > 0)
+                munmap(chunk, head);
+            munmap((char *)chunk + head + CHUNK_SIZE, CHUNK_SIZE - head);
+            chunk = (char *)chunk + head;
+#ifdef MADV_HUGEPAGE
+            madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+        }
     }
-}
+    else if (ftruncate(grid->pool, (off_t)(c + 1) * CHUNK_SIZE) == 0)
+        chunk = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, grid->pool, (off_t)c * CHUNK_SIZE);
+    else
+        chunk = MAP_FAILED;
 
-/* Enclosed points removal */
+    // Fall back to heap memory
+    if (chunk == MAP_FAILED)
+    {
+        fprintf(stderr, "Warning: Unable to map brick pool chunk. Using heap memory.\n");
+        grid->fallback = c;
+        return allocate_chunk(grid, c);
+    }
+
+    if (grid->pool == ANONYMOUS_POOL)
+        place_memory(chunk, CHUNK_SIZE, grid->placement);
+
+    return (signed char *)chunk;
+}
 
 /*
- * Function: remove_noise_points
- * -----------------------------
+ * Function: free_grid
+ * -------------------
  * 
- * Identify enclosed surface points based on neighboring points
+ * Free brick map
  * 
- * grid: 3D grid
- * nx: x grid units
- * ny: y grid units
- * nz: z grid units
- * i: x coordinate of point
- * j: y coordinate of point
- * k: z coordinate of point
+ * grid: brick map
  * 
- * returns: surface point (1) or solvent point (-1)
  */
-int remove_noise_points(int *grid, int nx, int ny, int nz, int i, int j, int k)
+void free_grid(brickmap *grid)
 {
-    int x, y, z;
-
-    // Loop around neighboring points
-    for (x = i - 1; x <= i + 1; x++)
-        for (y = j - 1; y <= j + 1; y++)
-            for (z = k - 1; z <= k + 1; z++)
-            {
-                // Check if point is inside 3D grid
-                if (x < 0 || y < 0 || z < 0 || x > nx - 1 || y > ny - 1 || z > nz - 1)
-                    ;
-                else if (grid[z + nz * (y + (ny * x))] == -1)
-                    return 1;
-            }
+    int c;
 
-    return 0;
+    for (c = 0; c < grid->nchunks; c++)
+        if (grid->chunks[c] != NULL)
+        {
+            if (grid->pool == HEAP_POOL || (grid->fallback >= 0 && c >= grid->fallback))
+                free(grid->chunks[c]);
+            else
+                munmap(grid->chunks[c], CHUNK_SIZE);
+        }
+    if (grid->pool >= 0)
+        close(grid->pool);
+    free(grid->chunks);
+    free(grid->slot);
+    free(grid->uniform);
 }
 
 /*
- * Function: filter_noise_points
- * -----------------------------
+ * Function: allocate_brick
+ * ------------------------
  * 
- * Inspect 3D grid and remove enclosed points on a surface 3D grid
+ * Allocate storage of a brick filled with its uniform label. Safe to call
+ * concurrently from OpenMP threads.
  * 
- * grid: 3D grid
- * surface: surface points 3D grid
- * nx: x grid units
- * ny: y grid units
- * nz: z grid units
- * nthreads: number of threads for OpenMP
+ * grid: brick map
+ * b: brick index
  * 
+ * returns: brick voxels
  */
-void filter_noise_points(int *grid, int nx, int ny, int nz, int nthreads)
+signed char *allocate_brick(brickmap *grid, int b)
 {
-    int i, j, k;
-
-    // Set number of threads in OpenMP
-    omp_set_num_threads(nthreads);
-    omp_set_nested(1);
+    int s;
 
-#pragma omp parallel default(none), shared(grid, nx, ny, nz), private(i, j, k)
+#pragma omp critical(bricks)
     {
-#pragma omp for collapse(3) schedule(static)
-        for (i = 0; i < nx; i++)
-            for (j = 0; j < ny; j++)
-                for (k = 0; k < nz; k++)
-                    if (grid[k + nz * (j + (ny * i))] == 1)
-                        // Remove enclosed regions
-                        grid[k + nz * (j + (ny * i))] = remove_noise_points(grid, nx, ny, nz, i, j, k);
+        s = grid->slot[b];
+        if (s == UNIFORM)
+        {
+            s = grid->nslots++;
+            if (grid->chunks[s >> CHUNK_SHIFT] == NULL)
+                grid->chunks[s >> CHUNK_SHIFT] = allocate_chunk(grid, s >> CHUNK_SHIFT);
+            memset(SLOT_VOXELS(grid, s), grid->uniform[b], BRICK_VOXELS);
+            __atomic_store_n(&grid->slot[b], s, __ATOMIC_RELEASE);
+        }
     }
-}
 
-/* Enclosed points removal - flood and fill algorithm */
+    return SLOT_VOXELS(grid, s);
+}
 
 /*
- * Variable: points
- * ----------------
+ * Function: brick_voxels
+ * ----------------------
  * 
- * Accumulate number of points while clustering surface points
- *
+ * Get storage of a brick
+ * 
+ * grid: brick map
+ * b: brick index
+ * 
+ * returns: brick voxels or NULL for uniform bricks
  */
-int points;
+static inline signed char *brick_voxels(brickmap *grid, int b)
+{
+    int s = __atomic_load_n(&grid->slot[b], __ATOMIC_ACQUIRE);
+
+    return s == UNIFORM ? NULL : SLOT_VOXELS(grid, s);
+}
 
 /*
- * Variable: big
+ * Function: has_label
+ * -------------------
  * 
- * Flag that marks big surfaces on clustering
+ * Checks if a brick may contain a label
+ * 
+ * grid: brick map
+ * b: brick index
+ * label: voxel label
  * 
+ * returns: true (int 1) or false (int 0)
  */
-int big;
+static inline int has_label(brickmap *grid, int b, signed char label)
+{
+    return brick_voxels(grid, b) != NULL || grid->uniform[b] == label;
+}
 
 /*
- * Function: check_unclustered_neighbours
- * --------------------------------------
+ * Function: get_voxel
+ * -------------------
  * 
- * Checks if a surface point on the grid is next to a unclustered surface point (1)
+ * Get label of a voxel
  * 
- * grid: 3D grid
- * dx: x grid units
- * dy: y grid units
- * dz: z grid units
+ * grid: brick map
  * i: x coordinate of point
  * j: y coordinate of point
  * k: z coordinate of point
  * 
- * returns: true (int 1) or false (int 0)
+ * returns: voxel label
  */
-int check_unclustered_neighbours(int *grid, int nx, int ny, int nz, int i, int j, int k)
+static inline signed char get_voxel(brickmap *grid, int i, int j, int k)
 {
-    int x, y, z;
+    int b = BRICK_INDEX(grid, i, j, k);
+    signed char *voxels = brick_voxels(grid, b);
 
-    // Loop around neighboring points
-    for (x = i - 1; x <= i + 1; x++)
-        for (y = j - 1; y <= j + 1; y++)
-            for (z = k - 1; z <= k + 1; z++)
-            {
-                // Check if point is inside 3D grid
-                if (x < 0 || y < 0 || z < 0 || x > nx - 1 || y > ny - 1 || z > nz - 1)
-                    ;
-                else if (grid[z + nz * (y + (ny * x))] > 1)
-                    return grid[z + nz * (y + (ny * x))];
-            }
-    return 0;
+    return voxels ? voxels[BRICK_OFFSET(i, j, k)] : grid->uniform[b];
 }
 
 /*
- * Function: flood_and_fill
- * ------------------------
+ * Function: voxel_address
+ * -----------------------
  * 
- * Recursive flood and fill algorithm
+ * Get storage of a voxel, allocating its brick when needed
  * 
- * grid: surface 3D grid
- * nx: x grid units
- * ny: y grid units
- * nz: z grid units
+ * grid: brick map
  * i: x coordinate of point
  * j: y coordinate of point
  * k: z coordinate of point
- * tag: integer identifier
  * 
+ * returns: voxel address
  */
-void flood_and_fill(int *grid, int nx, int ny, int nz, int i, int j, int k, int tag)
+static inline signed char *voxel_address(brickmap *grid, int i, int j, int k)
 {
-    int x, y, z;
+    int b = BRICK_INDEX(grid, i, j, k);
+    signed char *voxels = brick_voxels(grid, b);
 
-    if (i == 0 || i == nx - 1 || j == 0 || j == ny - 1 || k == 0 || k == nz - 1)
-        return;
+    if (voxels == NULL)
+        voxels = allocate_brick(grid, b);
 
-    if (grid[k + nz * (j + (ny * i))] == 1 && !big)
-    {
-        grid[k + nz * (j + (ny * i))] = tag;
-        points++;
+    return voxels + BRICK_OFFSET(i, j, k);
+}
 
-        if (points == 10000)
-            big = 1;
+/*
+ * Function: set_voxel
+ * -------------------
+ * 
+ * Set label of a voxel, allocating its brick only when label differs from
+ * the uniform label of the brick
+ * 
+ * grid: brick map
+ * i: x coordinate of point
+ * j: y coordinate of point
+ * k: z coordinate of point
+ * label: voxel label
+ * 
+ */
+static inline void set_voxel(brickmap *grid, int i, int j, int k, signed char label)
+{
+    int b = BRICK_INDEX(grid, i, j, k);
+    signed char *voxels = brick_voxels(grid, b);
 
-        if (!big)
-        {
-            for (x = i - 1; x <= i + 1; x++)
-                for (y = j - 1; y <= j + 1; y++)
-                    for (z = k - 1; z <= k + 1; z++)
-                        flood_and_fill(grid, nx, ny, nz, x, y, z, tag);
-        }
+    if (voxels == NULL)
+    {
+        if (grid->uniform[b] == label)
+            return;
+        voxels = allocate_brick(grid, b);
     }
+    voxels[BRICK_OFFSET(i, j, k)] = label;
 }
 
 /*
- * Function: filter_enclosed_regions
- * ---------------------------------
+ * Function: spread_bits
+ * ---------------------
  * 
- * Cluster consecutive surface points together and remove enclosed surface points
+ * Spread the 21 low bits of a coordinate two bits apart
  * 
- * grid: surface 3D grid
- * nx: x grid units
- * ny: y grid units
- * nz: z grid units
- * step: 3D grid spacing (A)
- * nthreads: number of threads for OpenMP
+ * v: coordinate
  * 
+ * returns: spread bits
  */
-void filter_enclosed_regions(int *grid, int nx, int ny, int nz, double step, int nthreads)
+static inline uint64_t spread_bits(uint64_t v)
 {
-    int i, j, k, i2, j2, k2, tag, aux;
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
 
-    // Set number of threads in OpenMP
-    omp_set_num_threads(nthreads);
-    omp_set_nested(1);
+/*
+ * Function: morton_key
+ * --------------------
+ * 
+ * Interleave bits of brick coordinates into a Morton (Z-order) key
+ * 
+ * bi: x brick coordinate
+ * bj: y brick coordinate
+ * bk: z brick coordinate
+ * 
+ * returns: Morton key
+ */
+uint64_t morton_key(int bi, int bj, int bk)
+{
+    return spread_bits(bk) | spread_bits(bj) << 1 | spread_bits(bi) << 2;
+}
 
-    // Initialize variables
-    tag = 1;
+/*
+ * Struct: ranked
+ * --------------
+ * 
+ * A brick pool slot or an atom ranked by a sort key
+ * 
+ * key: sort key
+ * slot: brick pool slot or atom index
+ * 
+ */
+typedef struct ranked
+{
+    uint64_t key;
+    int slot;
+} ranked;
+
+/*
+ * Function: compare_ranked
+ * ------------------------
+ * 
+ * Compare ranked slots by sort key (qsort comparator)
+ * 
+ * a: ranked slot
+ * b: ranked slot
+ * 
+ * returns: -1, 0 or 1
+ */
+int compare_ranked(const void *a, const void *b)
+{
+    uint64_t ka = ((const ranked *)a)->key, kb = ((const ranked *)b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/*
+ * Function: order_bricks
+ * ----------------------
+ * 
+ * Renumber allocated bricks so that brick pool slots follow the Morton
+ * order of brick coordinates. Bricks that are neighbours in the 3D grid
+ * are then close in memory for the brick-crossing stencils. The pool is
+ * permuted in place, one brick at a time, so it works for any backing.
+ * 
+ * grid: brick map
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void order_bricks(brickmap *grid, int nthreads)
+{
+    int b, r, s, next, *owner;
+    signed char brick[BRICK_VOXELS];
+    ranked *order;
+
+    if (grid->nslots < 2)
+        return;
+
+    // Find owner brick of each slot and rank slots by Morton key
+    owner = (int *)malloc(grid->nslots * sizeof(int));
+    order = (ranked *)malloc(grid->nslots * sizeof(ranked));
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, owner, order), private(b, s)
+    {
+#pragma omp for schedule(static)
+        for (b = 0; b < grid->nbricks; b++)
+        {
+            s = grid->slot[b];
+            if (s != UNIFORM)
+            {
+                owner[s] = b;
+                order[s].key = morton_key(b / (grid->by * grid->bz), (b / grid->bz) % grid->by, b % grid->bz);
+                order[s].slot = s;
+            }
+        }
+    }
+    qsort(order, grid->nslots, sizeof(ranked), compare_ranked);
+
+    // Move brick of slot order[r] to slot r, following permutation cycles
+    for (r = 0; r < grid->nslots; r++)
+    {
+        if (order[r].slot < 0)
+            continue;
+        memcpy(brick, SLOT_VOXELS(grid, r), BRICK_VOXELS);
+        s = r;
+        while (1)
+        {
+            next = order[s].slot;
+            order[s].slot = -1;
+            grid->slot[owner[next]] = s;
+            if (next == r)
+            {
+                memcpy(SLOT_VOXELS(grid, s), brick, BRICK_VOXELS);
+                break;
+            }
+            memcpy(SLOT_VOXELS(grid, s), SLOT_VOXELS(grid, next), BRICK_VOXELS);
+            s = next;
+        }
+    }
+
+    free(order);
+    free(owner);
+}
+
+/*
+ * Function: export_grid
+ * ---------------------
+ * 
+ * Copy brick map to a dense 3D grid (numpy layout), streaming slabs of 8 x
+ * planes. With release, each slab of a memory-mapped grid is flushed and
+ * its pages handed back to the operating system once written.
+ * 
+ * grid: brick map
+ * dense: 3D grid (nx * ny * nz)
+ * release: release slabs after writing (1) or not (0)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void export_grid(brickmap *grid, signed char *dense, int release, int nthreads)
+{
+    int i, j, k, b, length, slab, last, nx = grid->nx, ny = grid->ny, nz = grid->nz;
+    size_t start, end, page = (size_t)sysconf(_SC_PAGESIZE);
+    signed char *voxels;
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+    for (slab = 0; slab < nx; slab += BRICK)
+    {
+        last = nx - slab < BRICK ? nx : slab + BRICK;
+
+#pragma omp parallel default(none), shared(grid, dense, slab, last, ny, nz), private(i, j, k, b, length, voxels)
+        {
+#pragma omp for collapse(2) schedule(static)
+            for (i = slab; i < last; i++)
+                for (j = 0; j < ny; j++)
+                    for (k = 0; k < nz; k += BRICK)
+                    {
+                        b = BRICK_INDEX(grid, i, j, k);
+                        voxels = brick_voxels(grid, b);
+                        length = nz - k < BRICK ? nz - k : BRICK;
+                        if (voxels == NULL)
+                            memset(dense + k + (size_t)nz * (j + ((size_t)ny * i)), grid->uniform[b], length);
+                        else
+                            memcpy(dense + k + (size_t)nz * (j + ((size_t)ny * i)), voxels + BRICK_OFFSET(i, j, 0), length);
+                    }
+        }
+
+        // Flush written pages of slab and drop them from memory
+        if (release)
+        {
+            start = ((size_t)(dense + (size_t)slab * ny * nz) + page - 1) / page * page;
+            end = (size_t)(dense + (size_t)last * ny * nz) / page * page;
+            if (end > start)
+            {
+                msync((void *)start, end - start, MS_ASYNC);
+#ifdef __linux__
+                madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+            }
+        }
+    }
+}
+
+/*
+ * Function: encode_row
+ * --------------------
+ * 
+ * Run-length encode a z row of a brick map
+ * 
+ * grid: brick map
+ * i: x coordinate of row
+ * j: y coordinate of row
+ * runs: label of each run (NULL: only count runs)
+ * lengths: number of voxels of each run (NULL: only count runs)
+ * 
+ * returns: number of runs
+ */
+int encode_row(brickmap *grid, int i, int j, signed char *runs, int *lengths)
+{
+    int b, k, v, length, n = 0, nz = grid->nz;
+    signed char label, last = 0, *voxels;
+
+    for (k = 0; k < nz; k += BRICK)
+    {
+        b = BRICK_INDEX(grid, i, j, k);
+        voxels = brick_voxels(grid, b);
+        length = nz - k < BRICK ? nz - k : BRICK;
+        for (v = 0; v < length; v++)
+        {
+            label = voxels == NULL ? grid->uniform[b] : voxels[BRICK_OFFSET(i, j, k) + v];
+
+            // Uniform bricks extend a run by their whole length
+            if (n == 0 || label != last)
+            {
+                n++;
+                last = label;
+                if (runs != NULL)
+                {
+                    runs[n - 1] = label;
+                    lengths[n - 1] = 0;
+                }
+            }
+            if (runs != NULL)
+                lengths[n - 1] += voxels == NULL ? length - v : 1;
+            if (voxels == NULL)
+                break;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Function: encode_grid
+ * ---------------------
+ * 
+ * Run-length encode a brick map along z, without a dense intermediate.
+ * Runs never cross rows, so row (i, j) is decoded from runs offsets[r] to
+ * offsets[r + 1] - 1, with r = i * ny + j.
+ * 
+ * grid: brick map
+ * offsets: first run of each row and total number of runs (nx * ny + 1)
+ * runs: label of each run
+ * lengths: number of voxels of each run
+ * nthreads: number of threads for OpenMP
+ * 
+ * returns: number of runs
+ */
+int encode_grid(brickmap *grid, int **offsets, signed char **runs, int **lengths, int nthreads)
+{
+    int i, j, r, nrows = grid->nx * grid->ny, ny = grid->ny;
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+    // Count runs of each row
+    *offsets = (int *)malloc((nrows + 1) * sizeof(int));
+#pragma omp parallel default(none), shared(grid, offsets, nrows, ny), private(r)
+    {
+#pragma omp for schedule(static)
+        for (r = 0; r < nrows; r++)
+            (*offsets)[r + 1] = encode_row(grid, r / ny, r % ny, NULL, NULL);
+    }
+
+    // First run of each row
+    (*offsets)[0] = 0;
+    for (r = 0; r < nrows; r++)
+        (*offsets)[r + 1] += (*offsets)[r];
+
+    // Encode rows
+    *runs = (signed char *)malloc(((size_t)(*offsets)[nrows] + 1) * sizeof(signed char));
+    *lengths = (int *)malloc(((size_t)(*offsets)[nrows] + 1) * sizeof(int));
+#pragma omp parallel default(none), shared(grid, offsets, runs, lengths, nrows, ny), private(r, i, j)
+    {
+#pragma omp for schedule(static)
+        for (r = 0; r < nrows; r++)
+        {
+            i = r / ny;
+            j = r % ny;
+            encode_row(grid, i, j, *runs + (*offsets)[r], *lengths + (*offsets)[r]);
+        }
+    }
+
+    return (*offsets)[nrows];
+}
+
+/* SIMD kernels */
+#define LANES_LOW 0x0101010101010101ULL
+#define LANES_HIGH 0x8080808080808080ULL
+
+/*
+ * Kernel selection
+ * ----------------
+ * 
+ * Byte-wise kernels over brick rows (64 voxels) and brick storage are
+ * compiled for AVX-512BW, AVX2 and plain C, and select_kernels points the
+ * kernel table to the widest set the CPU supports at run time. Other
+ * compilers and architectures use the plain C kernels. Segments of brick
+ * rows (8 voxels) are updated as 64-bit words on every CPU.
+ * 
+ */
+static uint64_t pack_row_scalar(const signed char *voxels, signed char label)
+{
+    int yz;
+    uint64_t word = 0;
+
+    for (yz = 0; yz < BRICK * BRICK; yz++)
+        word |= (uint64_t)(voxels[yz] == label) << yz;
+
+    return word;
+}
+
+static void select_row_scalar(signed char *voxels, uint64_t dilated, signed char next, signed char apart)
+{
+    int yz;
+
+    for (yz = 0; yz < BRICK * BRICK; yz++)
+        if (voxels[yz] == 1)
+            voxels[yz] = ((dilated >> yz) & 1) ? next : apart;
+}
+
+static void replace_label_scalar(signed char *voxels, int n, signed char from, signed char to)
+{
+    int v;
+
+    for (v = 0; v < n; v++)
+        if (voxels[v] == from)
+            voxels[v] = to;
+}
+
+#ifdef X86_KERNELS
+__attribute__((target("avx2"))) static inline __m256i expand_bits_avx2(uint32_t bits)
+{
+    // Byte v of result is 0xFF when bit v is set
+    const __m256i lanes = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), lanes);
+
+    return _mm256_cmpeq_epi8(_mm256_and_si256(spread, select), select);
+}
+
+__attribute__((target("avx2"))) static uint64_t pack_row_avx2(const signed char *voxels, signed char label)
+{
+    __m256i target = _mm256_set1_epi8(label);
+    uint32_t low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)voxels), target));
+    uint32_t high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(voxels + 32)), target));
+
+    return (uint64_t)low | ((uint64_t)high << 32);
+}
+
+__attribute__((target("avx2"))) static void select_row_avx2(signed char *voxels, uint64_t dilated, signed char next, signed char apart)
+{
+    int half;
+    __m256i row, cavity;
+
+    for (half = 0; half < 2; half++)
+    {
+        row = _mm256_loadu_si256((const __m256i *)(voxels + 32 * half));
+        cavity = _mm256_cmpeq_epi8(row, _mm256_set1_epi8(1));
+        row = _mm256_blendv_epi8(row, _mm256_set1_epi8(apart), cavity);
+        row = _mm256_blendv_epi8(row, _mm256_set1_epi8(next), _mm256_and_si256(cavity, expand_bits_avx2((uint32_t)(dilated >> (32 * half)))));
+        _mm256_storeu_si256((__m256i *)(voxels + 32 * half), row);
+    }
+}
+
+__attribute__((target("avx2"))) static void replace_label_avx2(signed char *voxels, int n, signed char from, signed char to)
+{
+    int v;
+    __m256i row;
+
+    for (v = 0; v + 32 <= n; v += 32)
+    {
+        row = _mm256_loadu_si256((const __m256i *)(voxels + v));
+        row = _mm256_blendv_epi8(row, _mm256_set1_epi8(to), _mm256_cmpeq_epi8(row, _mm256_set1_epi8(from)));
+        _mm256_storeu_si256((__m256i *)(voxels + v), row);
+    }
+    replace_label_scalar(voxels + v, n - v, from, to);
+}
+
+__attribute__((target("avx512bw"))) static uint64_t pack_row_avx512(const signed char *voxels, signed char label)
+{
+    return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)voxels), _mm512_set1_epi8(label));
+}
+
+__attribute__((target("avx512bw"))) static void select_row_avx512(signed char *voxels, uint64_t dilated, signed char next, signed char apart)
+{
+    __m512i row = _mm512_loadu_si512((const void *)voxels);
+    __mmask64 cavity = _mm512_cmpeq_epi8_mask(row, _mm512_set1_epi8(1));
+
+    row = _mm512_mask_mov_epi8(row, cavity & dilated, _mm512_set1_epi8(next));
+    row = _mm512_mask_mov_epi8(row, cavity & ~dilated, _mm512_set1_epi8(apart));
+    _mm512_storeu_si512((void *)voxels, row);
+}
+
+__attribute__((target("avx512bw"))) static void replace_label_avx512(signed char *voxels, int n, signed char from, signed char to)
+{
+    int v;
+    __m512i row;
+
+    for (v = 0; v + 64 <= n; v += 64)
+    {
+        row = _mm512_loadu_si512((const void *)(voxels + v));
+        row = _mm512_mask_mov_epi8(row, _mm512_cmpeq_epi8_mask(row, _mm512_set1_epi8(from)), _mm512_set1_epi8(to));
+        _mm512_storeu_si512((void *)(voxels + v), row);
+    }
+    replace_label_scalar(voxels + v, n - v, from, to);
+}
+#endif
+
+/*
+ * Function: replace_lanes
+ * -----------------------
+ * 
+ * Replace a label in a range of voxels of a brick row (8 voxels along z),
+ * handling the row as one 64-bit word of 8 lanes. Rows may be shared with
+ * other threads replacing the same label, so the word is swapped atomically
+ * and lanes outside the range are never written back stale
+ * 
+ * row: first voxel of brick row
+ * first: first lane of range
+ * last: last lane of range
+ * from: label to replace
+ * to: new label
+ * 
+ */
+static inline void replace_lanes(signed char *row, int first, int last, signed char from, signed char to)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word, update, match, lanes, range = (~(uint64_t)0 << (8 * first)) & (~(uint64_t)0 >> (8 * (BRICK_MASK - last)));
+
+    word = __atomic_load_n((uint64_t *)row, __ATOMIC_RELAXED);
+    do
+    {
+        // Lanes holding label are zero after xor, so only their high bit is set
+        match = word ^ ((unsigned char)from * LANES_LOW);
+        match = ~(((match & ~LANES_HIGH) + ~LANES_HIGH) | match | ~LANES_HIGH);
+        lanes = range & ((match >> 7) * 0xFF);
+        if (!lanes)
+            return;
+        update = (word & ~lanes) | (((unsigned char)to * LANES_LOW) & lanes);
+    } while (!__atomic_compare_exchange_n((uint64_t *)row, &word, update, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+    int v;
+
+    for (v = first; v <= last; v++)
+        if (row[v] == from)
+            row[v] = to;
+#endif
+}
+
+// Kernel table
+static uint64_t (*pack_row)(const signed char *voxels, signed char label) = pack_row_scalar;
+static void (*select_row)(signed char *voxels, uint64_t dilated, signed char next, signed char apart) = select_row_scalar;
+static void (*replace_label)(signed char *voxels, int n, signed char from, signed char to) = replace_label_scalar;
+
+/*
+ * Function: select_kernels
+ * ------------------------
+ * 
+ * Point kernel table to the widest SIMD kernels supported by the CPU
+ * 
+ */
+void select_kernels(void)
+{
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        pack_row = pack_row_avx512;
+        select_row = select_row_avx512;
+        replace_label = replace_label_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        pack_row = pack_row_avx2;
+        select_row = select_row_avx2;
+        replace_label = replace_label_avx2;
+    }
+#endif
+}
+
+/* Bit-packed occupancy bricks */
+
+/*
+ * Occupancy brick layout
+ * ----------------------
+ * 
+ * One bit per voxel and 8 words per brick, one for each x slice. Each word
+ * holds 64 voxels of a slice, 8 along z for each of the 8 y rows, so voxel
+ * (x, y, z) of a brick is bit (z + 8 * y) of word x. Uniform bricks are not
+ * stored: they are EMPTY_BITS when the label is absent and FULL_BITS when
+ * all its voxels have the label.
+ * 
+ */
+#define EMPTY_BITS -1
+#define FULL_BITS -2
+
+/*
+ * Struct: bitbricks
+ * -----------------
+ * 
+ * Bit-packed occupancy of a label over a brick map
+ * 
+ * slot: word slot of each brick (EMPTY_BITS or FULL_BITS for uniform bricks)
+ * words: 8 words per slot
+ * capacity: number of bricks of slot array
+ * nwords: number of words of words array
+ * 
+ */
+typedef struct bitbricks
+{
+    int *slot;
+    uint64_t *words;
+    int capacity;
+    size_t nwords;
+} bitbricks;
+
+/*
+ * Function: valid_bits
+ * --------------------
+ * 
+ * Mask of voxels of a brick slice that are inside the 3D grid
+ * 
+ * grid: brick map
+ * bi: x brick coordinate
+ * bj: y brick coordinate
+ * bk: z brick coordinate
+ * x: slice of brick
+ * 
+ * returns: slice mask
+ */
+static inline uint64_t valid_bits(brickmap *grid, int bi, int bj, int bk, int x)
+{
+    int nyv, nzv;
+
+    if ((bi << BRICK_SHIFT) + x >= grid->nx)
+        return 0;
+
+    nyv = grid->ny - (bj << BRICK_SHIFT);
+    nzv = grid->nz - (bk << BRICK_SHIFT);
+    if (nyv >= BRICK && nzv >= BRICK)
+        return ~(uint64_t)0;
+    nyv = nyv < BRICK ? nyv : BRICK;
+    nzv = nzv < BRICK ? nzv : BRICK;
+
+    return (((uint64_t)1 << nzv) - 1) * LANES_LOW & (nyv == BRICK ? ~(uint64_t)0 : ((uint64_t)1 << (8 * nyv)) - 1);
+}
+
+/*
+ * Function: ibits
+ * ---------------
+ * 
+ * Initialize empty occupancy bricks
+ * 
+ * bits: occupancy bricks
+ * 
+ */
+void ibits(bitbricks *bits)
+{
+    bits->slot = NULL;
+    bits->words = NULL;
+    bits->capacity = 0;
+    bits->nwords = 0;
+}
+
+/*
+ * Function: pack_bricks
+ * ---------------------
+ * 
+ * Pack voxels with a given label of a brick map into occupancy bricks.
+ * Arrays of occupancy bricks only grow, so they are reused between calls.
+ * 
+ * grid: brick map
+ * label: label of packed voxels
+ * bits: occupancy bricks
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void pack_bricks(brickmap *grid, signed char label, bitbricks *bits, int nthreads)
+{
+    int b, bi, bj, bk, x, s, nslots, full, empty;
+    uint64_t valid, words[BRICK];
+    signed char *voxels;
+
+    if (grid->nbricks > bits->capacity)
+    {
+        bits->capacity = grid->nbricks;
+        free(bits->slot);
+        bits->slot = (int *)huge_alloc(bits->capacity * sizeof(int));
+        place_memory(bits->slot, bits->capacity * sizeof(int), grid->placement);
+    }
+    if (((size_t)grid->nslots + 1) * BRICK > bits->nwords)
+    {
+        bits->nwords = ((size_t)grid->nslots + 1) * BRICK;
+        free(bits->words);
+        bits->words = (uint64_t *)huge_alloc(bits->nwords * sizeof(uint64_t));
+        place_memory(bits->words, bits->nwords * sizeof(uint64_t), grid->placement);
+    }
+    nslots = 0;
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, label, bits, nslots, pack_row), private(b, bi, bj, bk, x, s, full, empty, valid, words, voxels)
+    {
+#pragma omp for schedule(static)
+        for (b = 0; b < grid->nbricks; b++)
+        {
+            voxels = brick_voxels(grid, b);
+            if (voxels == NULL)
+            {
+                bits->slot[b] = grid->uniform[b] == label ? FULL_BITS : EMPTY_BITS;
+                continue;
+            }
+
+            bi = b / (grid->by * grid->bz);
+            bj = (b / grid->bz) % grid->by;
+            bk = b % grid->bz;
+            full = 1;
+            empty = 1;
+            for (x = 0; x < BRICK; x++)
+            {
+                valid = valid_bits(grid, bi, bj, bk, x);
+                words[x] = pack_row(voxels + BRICK * BRICK * x, label) & valid;
+                full &= words[x] == valid;
+                empty &= words[x] == 0;
+            }
+
+            if (empty)
+                bits->slot[b] = EMPTY_BITS;
+            else if (full)
+                bits->slot[b] = FULL_BITS;
+            else
+            {
+#pragma omp atomic capture
+                s = nslots++;
+                memcpy(bits->words + (size_t)s * BRICK, words, sizeof(words));
+                bits->slot[b] = s;
+            }
+        }
+    }
+}
+
+/*
+ * Function: free_bits
+ * -------------------
+ * 
+ * Free occupancy bricks
+ * 
+ * bits: occupancy bricks
+ * 
+ */
+void free_bits(bitbricks *bits)
+{
+    free(bits->words);
+    free(bits->slot);
+}
+
+/*
+ * Function: slice_bits
+ * --------------------
+ * 
+ * Get occupancy of a brick slice
+ * 
+ * grid: brick map
+ * bits: occupancy bricks
+ * bi: x brick coordinate
+ * bj: y brick coordinate
+ * bk: z brick coordinate
+ * x: slice of brick
+ * 
+ * returns: slice occupancy (0 outside 3D grid)
+ */
+static inline uint64_t slice_bits(brickmap *grid, bitbricks *bits, int bi, int bj, int bk, int x)
+{
+    int s;
+
+    if (bi < 0 || bj < 0 || bk < 0 || bi >= grid->bx || bj >= grid->by || bk >= grid->bz)
+        return 0;
+
+    s = bits->slot[(bi * grid->by + bj) * grid->bz + bk];
+    if (s == EMPTY_BITS)
+        return 0;
+    if (s == FULL_BITS)
+        return valid_bits(grid, bi, bj, bk, x);
+
+    return bits->words[(size_t)s * BRICK + x];
+}
+
+/*
+ * Function: dilate_brick
+ * ----------------------
+ * 
+ * Dilate occupancy of a brick by its 26 neighbours with word-wide shifts
+ * and ORs, applied separably along z, y and x
+ * 
+ * grid: brick map
+ * bits: occupancy bricks
+ * bi: x brick coordinate
+ * bj: y brick coordinate
+ * bk: z brick coordinate
+ * dilated: dilated occupancy of brick (8 words)
+ * 
+ * returns: true (int 1) if any voxel of brick is next to the label or false (int 0)
+ */
+int dilate_brick(brickmap *grid, bitbricks *bits, int bi, int bj, int bk, uint64_t *dilated)
+{
+    int x, dx, dy, dz, any;
+    uint64_t slice[3][3], z[3], yz[BRICK + 2];
+
+    // Skip bricks without the label in their neighbourhood
+    any = 0;
+    for (dx = -1; dx <= 1 && !any; dx++)
+        for (dy = -1; dy <= 1 && !any; dy++)
+            for (dz = -1; dz <= 1 && !any; dz++)
+                if (bi + dx >= 0 && bj + dy >= 0 && bk + dz >= 0 && bi + dx < grid->bx && bj + dy < grid->by && bk + dz < grid->bz)
+                    any = bits->slot[((bi + dx) * grid->by + bj + dy) * grid->bz + bk + dz] != EMPTY_BITS;
+    if (!any)
+    {
+        memset(dilated, 0, BRICK * sizeof(uint64_t));
+        return 0;
+    }
+
+    // Dilate along z and y each slice, including one slice of x neighbours
+    for (x = -1; x <= BRICK; x++)
+    {
+        dx = x < 0 ? -1 : (x == BRICK ? 1 : 0);
+        for (dy = 0; dy < 3; dy++)
+            for (dz = 0; dz < 3; dz++)
+                slice[dy][dz] = slice_bits(grid, bits, bi + dx, bj + dy - 1, bk + dz - 1, x & BRICK_MASK);
+
+        for (dy = 0; dy < 3; dy++)
+            z[dy] = slice[dy][1] | ((slice[dy][1] << 1) & ~LANES_LOW) | ((slice[dy][1] >> 1) & ~LANES_HIGH) | ((slice[dy][0] >> 7) & LANES_LOW) | ((slice[dy][2] << 7) & LANES_HIGH);
+
+        yz[x + 1] = z[1] | (z[1] << 8) | (z[1] >> 8) | (z[0] >> 56) | (z[2] << 56);
+    }
+
+    // Dilate along x
+    any = 0;
+    for (x = 0; x < BRICK; x++)
+    {
+        dilated[x] = (yz[x] | yz[x + 1] | yz[x + 2]) & valid_bits(grid, bi, bj, bk, x);
+        any |= dilated[x] != 0;
+    }
+
+    return any;
+}
+
+/*
+ * Function: filter_brick
+ * ----------------------
+ * 
+ * Relabel points (1) of a brick depending on whether they are next to a
+ * label packed in occupancy bricks
+ * 
+ * grid: brick map
+ * bits: occupancy bricks
+ * b: brick index
+ * next: new label of points next to packed label
+ * apart: new label of points apart from packed label
+ * 
+ */
+void filter_brick(brickmap *grid, bitbricks *bits, int b, signed char next, signed char apart)
+{
+    int x, bi, bj, bk, full;
+    uint64_t dilated[BRICK];
+    signed char *voxels;
+
+    voxels = brick_voxels(grid, b);
+    if (voxels == NULL && grid->uniform[b] != 1)
+        return;
+
+    bi = b / (grid->by * grid->bz);
+    bj = (b / grid->bz) % grid->by;
+    bk = b % grid->bz;
+
+    if (!dilate_brick(grid, bits, bi, bj, bk, dilated))
+    {
+        // No point of brick is next to packed label
+        if (voxels == NULL)
+        {
+            grid->uniform[b] = apart;
+            return;
+        }
+    }
+    else if (voxels == NULL)
+    {
+        // Every point of brick is next to packed label
+        full = 1;
+        for (x = 0; x < BRICK; x++)
+            full &= dilated[x] == valid_bits(grid, bi, bj, bk, x);
+        if (full)
+        {
+            grid->uniform[b] = next;
+            return;
+        }
+        voxels = allocate_brick(grid, b);
+    }
+
+    for (x = 0; x < BRICK; x++)
+        select_row(voxels + BRICK * BRICK * x, dilated[x], next, apart);
+}
+
+/*
+ * Function: collapse_bricks
+ * -------------------------
+ * 
+ * Turn allocated bricks whose voxels share one label back into uniform
+ * bricks and compact the brick pool, keeping the order of the remaining
+ * slots. Later stages then skip homogeneous bricks (buried biomolecule,
+ * bulk solvent) entirely, so their work follows the surface shell.
+ * 
+ * grid: brick map
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void collapse_bricks(brickmap *grid, int nthreads)
+{
+    int b, s, r, w, homogeneous, *owner;
+    uint64_t word;
+    signed char *voxels;
+
+    if (grid->nslots == 0)
+        return;
+
+    owner = (int *)malloc(grid->nslots * sizeof(int));
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, owner), private(b, s, w, homogeneous, word, voxels)
+    {
+#pragma omp for schedule(static)
+        for (s = 0; s < grid->nslots; s++)
+            owner[s] = UNIFORM;
+
+#pragma omp for schedule(static)
+        for (b = 0; b < grid->nbricks; b++)
+        {
+            s = grid->slot[b];
+            if (s == UNIFORM)
+                continue;
+
+            // Compare all voxels with the first one, 8 voxels at a time
+            voxels = SLOT_VOXELS(grid, s);
+            homogeneous = 1;
+            for (w = 0; w < BRICK_VOXELS && homogeneous; w += 8)
+            {
+                memcpy(&word, voxels + w, sizeof(word));
+                homogeneous = word == (uint64_t)(unsigned char)voxels[0] * LANES_LOW;
+            }
+
+            if (homogeneous)
+            {
+                grid->uniform[b] = voxels[0];
+                grid->slot[b] = UNIFORM;
+            }
+            else
+                owner[s] = b;
+        }
+    }
+
+    // Move remaining bricks down to the first free slots
+    for (s = 0, r = 0; s < grid->nslots; s++)
+        if (owner[s] != UNIFORM)
+        {
+            if (r != s)
+                memcpy(SLOT_VOXELS(grid, r), SLOT_VOXELS(grid, s), BRICK_VOXELS);
+            grid->slot[owner[s]] = r++;
+        }
+    grid->nslots = r;
+
+    free(owner);
+}
+
+/* Grid filling */
+
+/*
+ * Function: project_atom
+ * ----------------------
+ * 
+ * Convert atom coordinates in 3D grid coordinates
+ * 
+ * atoms: xyz coordinates and radii of input pdb
+ * atom: atom index
+ * reference: xyz coordinates of 3D grid origin
+ * sincos: sin and cos of 3D grid angles
+ * step: 3D grid spacing (A)
+ * center: xyz grid coordinates and radius (A) of atom (output)
+ * 
+ */
+static inline void project_atom(double *atoms, int atom, double *reference, double *sincos, double step, double *center)
+{
+    double x, y, z, xaux, yaux, zaux;
+
+    x = (atoms[atom * 4] - reference[0]) / step;
+    y = (atoms[1 + (atom * 4)] - reference[1]) / step;
+    z = (atoms[2 + (atom * 4)] - reference[2]) / step;
+
+    xaux = x * sincos[3] + z * sincos[2];
+    yaux = y;
+    zaux = (-x) * sincos[2] + z * sincos[3];
+
+    center[0] = xaux;
+    center[1] = yaux * sincos[1] - zaux * sincos[0];
+    center[2] = yaux * sincos[0] + zaux * sincos[1];
+    center[3] = atoms[3 + (atom * 4)];
+}
+
+/*
+ * Function: shift_atom
+ * --------------------
+ * 
+ * Convert atom coordinates in 3D grid coordinates of a 3D grid without
+ * rotation
+ * 
+ * atoms: xyz coordinates and radii of input pdb
+ * atom: atom index
+ * reference: xyz coordinates of 3D grid origin
+ * step: 3D grid spacing (A)
+ * center: xyz grid coordinates and radius (A) of atom (output)
+ * 
+ */
+static inline void shift_atom(double *atoms, int atom, double *reference, double step, double *center)
+{
+    center[0] = (atoms[atom * 4] - reference[0]) / step;
+    center[1] = (atoms[1 + (atom * 4)] - reference[1]) / step;
+    center[2] = (atoms[2 + (atom * 4)] - reference[2]) / step;
+    center[3] = atoms[3 + (atom * 4)];
+}
+
+/*
+ * Function: grid_radius
+ * ---------------------
+ * 
+ * Create a radius (H) for space occupied by probe and atom in 3D grid units
+ * 
+ * radius: atom radius (A)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * 
+ * returns: radius in 3D grid units
+ */
+static inline double grid_radius(double radius, double step, double probe)
+{
+    return (probe + radius) / step;
+}
+
+/*
+ * Function: sort_atoms
+ * --------------------
+ * 
+ * Rank atoms by Morton key of the brick holding their 3D grid center, so
+ * that consecutive atoms in the ranking touch neighbouring grid regions
+ * 
+ * centers: xyz grid coordinates and radius (grid units) of atoms
+ * natoms: number of atoms
+ * order: original atom index of each rank (output)
+ * 
+ */
+void sort_atoms(double *centers, int natoms, int *order)
+{
+    int atom, bi, bj, bk;
+    ranked *ranking;
+
+    ranking = (ranked *)malloc(natoms * sizeof(ranked));
+    for (atom = 0; atom < natoms; atom++)
+    {
+        // Brick of atom center, atoms outside the 3D grid go to its border
+        bi = centers[atom * 4] > 0 ? (int)centers[atom * 4] >> BRICK_SHIFT : 0;
+        bj = centers[1 + (atom * 4)] > 0 ? (int)centers[1 + (atom * 4)] >> BRICK_SHIFT : 0;
+        bk = centers[2 + (atom * 4)] > 0 ? (int)centers[2 + (atom * 4)] >> BRICK_SHIFT : 0;
+        ranking[atom].key = morton_key(bi, bj, bk);
+        ranking[atom].slot = atom;
+    }
+    qsort(ranking, natoms, sizeof(ranked), compare_ranked);
+    for (atom = 0; atom < natoms; atom++)
+        order[atom] = ranking[atom].slot;
+    free(ranking);
+}
+
+/*
+ * Struct: projection
+ * ------------------
+ * 
+ * Atoms converted in 3D grid coordinates, kept to be shared between surface
+ * and interface definitions of the same atoms
+ * 
+ * centers: xyz grid coordinates and radius (A) of each atom
+ * order: atoms in Morton order of their centers
+ * natoms: number of atoms
+ * capacity: number of atoms of centers and order arrays
+ * 
+ */
+typedef struct projection
+{
+    double *centers;
+    int *order;
+    int natoms;
+    int capacity;
+} projection;
+
+/*
+ * Function: iprojection
+ * ---------------------
+ * 
+ * Initialize an empty projection
+ * 
+ * projected: projection
+ * 
+ */
+void iprojection(projection *projected)
+{
+    projected->centers = NULL;
+    projected->order = NULL;
+    projected->natoms = 0;
+    projected->capacity = 0;
+}
+
+/*
+ * Function: project_atoms
+ * -----------------------
+ * 
+ * Convert atoms in 3D grid coordinates and rank them in Morton order. The
+ * rotation is skipped for 3D grids aligned with the axes (sina = sinb = 0
+ * and cosa = cosb = 1), as built by get_vertices
+ * 
+ * projected: projection
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * reference: xyz coordinates of 3D grid origin
+ * sincos: sin and cos of 3D grid angles
+ * step: 3D grid spacing (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void project_atoms(projection *projected, double *atoms, int natoms, double *reference, double *sincos, double step, int nthreads)
+{
+    int atom, rotated = !(sincos[0] == 0.0 && sincos[1] == 1.0 && sincos[2] == 0.0 && sincos[3] == 1.0);
+    double *centers;
+
+    if (natoms > projected->capacity)
+    {
+        projected->capacity = natoms;
+        free(projected->centers);
+        free(projected->order);
+        projected->centers = (double *)malloc(natoms * 4 * sizeof(double));
+        projected->order = (int *)malloc(natoms * sizeof(int));
+    }
+    projected->natoms = natoms;
+    centers = projected->centers;
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(atoms, natoms, reference, sincos, step, centers, rotated), private(atom)
+    {
+        if (rotated)
+        {
+#pragma omp for schedule(static)
+            for (atom = 0; atom < natoms; atom++)
+                project_atom(atoms, atom, reference, sincos, step, centers + atom * 4);
+        }
+        else
+        {
+#pragma omp for schedule(static)
+            for (atom = 0; atom < natoms; atom++)
+                shift_atom(atoms, atom, reference, step, centers + atom * 4);
+        }
+    }
+
+    sort_atoms(centers, natoms, projected->order);
+}
+
+/*
+ * Function: free_projection
+ * -------------------------
+ * 
+ * Free projection buffers
+ * 
+ * projected: projection
+ * 
+ */
+void free_projection(projection *projected)
+{
+    free(projected->centers);
+    free(projected->order);
+}
+
+/* Fixed-point grid coordinates (16.16) */
+#define FIXED_SHIFT 16
+#define FIXED_ONE ((int64_t)1 << FIXED_SHIFT)
+#define FIXED_FLOOR(v) ((int)((v) >> FIXED_SHIFT))
+#define FIXED_CEIL(v) (-(int)((-(v)) >> FIXED_SHIFT))
+
+/*
+ * Function: to_fixed
+ * ------------------
+ * 
+ * Round a 3D grid coordinate or length to fixed point (16.16)
+ * 
+ * v: grid coordinate or length (grid units)
+ * 
+ * returns: fixed-point value
+ */
+static inline int64_t to_fixed(double v)
+{
+    return (int64_t)llround(v * FIXED_ONE);
+}
+
+/* Radius-class stencils */
+#define MAX_CLASSES 64
+#define BUCKETS 4
+#define STENCIL_MARGIN 1e-9
+#define STENCIL_ROW(st, bi, bj, di, dj) ((st)->rows + 4 * ((((bi) * BUCKETS + (bj)) * (st)->width + (di) + (st)->extent) * (st)->width + (dj) + (st)->extent))
+
+typedef struct stencil
+{
+    double H;
+    int extent;
+    int width;
+    short *rows;
+} stencil;
+
+/*
+ * Function: bucket_range
+ * ----------------------
+ * 
+ * Get range of squared distance along an axis between a grid offset and
+ * the fractional positions of a bucket
+ * 
+ * d: grid offset from voxel holding atom center
+ * b: bucket of fractional position of atom center
+ * low: minimum squared distance (output)
+ * high: maximum squared distance (output)
+ * 
+ */
+static inline void bucket_range(int d, int b, double *low, double *high)
+{
+    double lower = d - (b + 1.0) / BUCKETS, upper = d - (double)b / BUCKETS;
+
+    *high = fmax(lower * lower, upper * upper);
+    *low = (lower <= 0.0 && upper >= 0.0) ? 0.0 : fmin(lower * lower, upper * upper);
+}
+
+/*
+ * Function: build_stencil
+ * -----------------------
+ * 
+ * Build sphere stencil of a radius class. For each bucket of fractional
+ * position of atom center in x and y, and each (x, y) offset from voxel
+ * holding atom center, a row keeps the z offsets of voxels inside the
+ * sphere for every position in the bucket and of voxels inside for some
+ * position, so only voxels in between need a distance test
+ * 
+ * st: stencil
+ * H: radius of class (grid units)
+ * 
+ */
+void build_stencil(stencil *st, double H)
+{
+    int bi, bj, di, dj, e;
+    double xlow, xhigh, ylow, yhigh, rest, w;
+    short *row;
+
+    st->H = H;
+    st->extent = e = (int)ceil(H) + 1;
+    st->width = 2 * e + 1;
+    st->rows = (short *)malloc((size_t)4 * BUCKETS * BUCKETS * st->width * st->width * sizeof(short));
+
+    for (bi = 0; bi < BUCKETS; bi++)
+        for (bj = 0; bj < BUCKETS; bj++)
+            for (di = -e; di <= e; di++)
+                for (dj = -e; dj <= e; dj++)
+                {
+                    row = STENCIL_ROW(st, bi, bj, di, dj);
+                    bucket_range(di, bi, &xlow, &xhigh);
+                    bucket_range(dj, bj, &ylow, &yhigh);
+
+                    // Inside for every position: |dk - fz| < w for fz in [0, 1)
+                    rest = H * H * (1.0 - STENCIL_MARGIN) - xhigh - yhigh;
+                    w = rest > 0.0 ? sqrt(rest) : 0.0;
+                    row[0] = (short)(floor(1.0 - w) + 1);
+                    row[1] = (short)(ceil(w) - 1);
+
+                    // Inside for some position: |dk - fz| < w for some fz in [0, 1)
+                    rest = H * H * (1.0 + STENCIL_MARGIN) - xlow - ylow;
+                    if (rest > 0.0)
+                    {
+                        w = sqrt(rest);
+                        row[2] = (short)(floor(-w) + 1);
+                        row[3] = (short)(ceil(1.0 + w) - 1);
+                    }
+                    else
+                    {
+                        row[2] = 1;
+                        row[3] = 0;
+                    }
+                }
+}
+
+/*
+ * Function: square_offset
+ * -----------------------
+ * 
+ * Squared distance along an axis between a grid coordinate and a fixed-point
+ * coordinate
+ * 
+ * k: grid coordinate
+ * z: fixed-point coordinate (16.16)
+ * 
+ * returns: squared distance (32.32)
+ */
+static inline int64_t square_offset(int k, int64_t z)
+{
+    int64_t d = ((int64_t)k << FIXED_SHIFT) - z;
+
+    return d * d;
+}
+
+/*
+ * Function: shrink_span
+ * ---------------------
+ * 
+ * Shrink z bounds of a row to the span of voxels inside an atom. Voxels
+ * between inner bounds are known to be inside, so only voxels between
+ * outer and inner bounds are compared with squared distance from atom
+ * center
+ * 
+ * kmin: first z grid coordinate that may be inside (input and output)
+ * kmax: last z grid coordinate that may be inside (input and output)
+ * kin: first z grid coordinate known to be inside
+ * kout: last z grid coordinate known to be inside
+ * d2: squared distance in x and y between row and atom center (32.32)
+ * z: z grid coordinate of atom center (16.16)
+ * H2: squared radius of atom (32.32)
+ * 
+ */
+static inline void shrink_span(int *kmin, int *kmax, int kin, int kout, int64_t d2, int64_t z, int64_t H2)
+{
+    while (*kmin <= *kmax && (*kmin < kin || *kmin > kout) && d2 + square_offset(*kmin, z) >= H2)
+        (*kmin)++;
+    while (*kmax >= *kmin && (*kmax < kin || *kmax > kout) && d2 + square_offset(*kmax, z) >= H2)
+        (*kmax)--;
+}
+
+/*
+ * Function: fill_row
+ * ------------------
+ * 
+ * Insert span of a z row inside a 3D grid, one brick segment at a time
+ * 
+ * grid: brick map
+ * i: x grid coordinate of row
+ * j: y grid coordinate of row
+ * kmin: first z grid coordinate of span
+ * kmax: last z grid coordinate of span
+ * 
+ */
+static inline void fill_row(brickmap *grid, int i, int j, int kmin, int kmax)
+{
+    int k, k2, kend;
+    signed char *voxels;
+
+    for (k = kmin; k <= kmax; k = kend + 1)
+    {
+        kend = (k | BRICK_MASK) < kmax ? (k | BRICK_MASK) : kmax;
+        if ((voxels = brick_voxels(grid, BRICK_INDEX(grid, i, j, k))) == NULL)
+            voxels = allocate_brick(grid, BRICK_INDEX(grid, i, j, k));
+        for (k2 = k; k2 <= kend; k2++)
+            voxels[BRICK_OFFSET(i, j, k2)] = 0;
+    }
+}
+
+/*
+ * Function: fill_atom
+ * -------------------
+ * 
+ * Insert an atom inside the x planes of a slab of a 3D grid, as spans of
+ * z rows. With a stencil, spans are bounded by the stencil of its radius
+ * class. Voxels are tested against the sphere in fixed point, so labels do
+ * not depend on floating-point rounding of the machine
+ * 
+ * grid: brick map
+ * st: stencil of radius class of atom (NULL: no radius class)
+ * x: x grid coordinate of atom center (16.16)
+ * y: y grid coordinate of atom center (16.16)
+ * z: z grid coordinate of atom center (16.16)
+ * H: radius of atom (grid units, 16.16)
+ * first: first x plane of slab
+ * last: last x plane of slab
+ * 
+ */
+void fill_atom(brickmap *grid, stencil *st, int64_t x, int64_t y, int64_t z, int64_t H, int first, int last)
+{
+    int i, j, i0, j0, k0, bi, bj, e, imin, imax, jmin, jmax, kmin, kmax, nz = grid->nz;
+    int64_t H2 = H * H, d2;
+    double w;
+    short *row;
+
+    if (st == NULL)
+    {
+        // Clip radius from atom center to slab
+        imin = FIXED_FLOOR(x - H) > first ? FIXED_FLOOR(x - H) : first;
+        imax = FIXED_CEIL(x + H) < last ? FIXED_CEIL(x + H) : last;
+        jmin = FIXED_FLOOR(y - H) > 0 ? FIXED_FLOOR(y - H) : 0;
+        jmax = FIXED_CEIL(y + H) < grid->ny - 1 ? FIXED_CEIL(y + H) : grid->ny - 1;
+
+        // Loop around rows from atom center, bounding spans one voxel past
+        // the sphere before exact tests
+        for (i = imin; i <= imax; i++)
+            for (j = jmin; j <= jmax; j++)
+            {
+                d2 = square_offset(i, x) + square_offset(j, y);
+                if (d2 >= H2)
+                    continue;
+                w = sqrt((double)(H2 - d2)) / FIXED_ONE;
+                kmin = (int)floor((double)z / FIXED_ONE - w) - 1;
+                kmax = (int)ceil((double)z / FIXED_ONE + w) + 1;
+                shrink_span(&kmin, &kmax, 1, 0, d2, z, H2);
+                kmin = kmin > 0 ? kmin : 0;
+                kmax = kmax < nz - 1 ? kmax : nz - 1;
+                if (kmin <= kmax)
+                    fill_row(grid, i, j, kmin, kmax);
+            }
+        return;
+    }
+
+    // Look up stencil of fractional position bucket
+    e = st->extent;
+    i0 = FIXED_FLOOR(x);
+    j0 = FIXED_FLOOR(y);
+    k0 = FIXED_FLOOR(z);
+    bi = (int)(((x & (FIXED_ONE - 1)) * BUCKETS) >> FIXED_SHIFT);
+    bj = (int)(((y & (FIXED_ONE - 1)) * BUCKETS) >> FIXED_SHIFT);
+
+    // Clip stencil to slab
+    imin = i0 - e > first ? i0 - e : first;
+    imax = i0 + e < last ? i0 + e : last;
+    jmin = j0 - e > 0 ? j0 - e : 0;
+    jmax = j0 + e < grid->ny - 1 ? j0 + e : grid->ny - 1;
+
+    // Loop around stencil rows
+    for (i = imin; i <= imax; i++)
+        for (j = jmin; j <= jmax; j++)
+        {
+            row = STENCIL_ROW(st, bi, bj, i - i0, j - j0);
+            if (row[2] > row[3])
+                continue;
+            kmin = k0 + row[2];
+            kmax = k0 + row[3];
+            shrink_span(&kmin, &kmax, k0 + row[0], k0 + row[1], square_offset(i, x) + square_offset(j, y), z, H2);
+            kmin = kmin > 0 ? kmin : 0;
+            kmax = kmax < nz - 1 ? kmax : nz - 1;
+            if (kmin <= kmax)
+                fill_row(grid, i, j, kmin, kmax);
+        }
+}
+
+/*
+ * Function: bin_atoms
+ * -------------------
+ * 
+ * Bin atoms into every x slab (one brick thick) between their lower and
+ * upper x planes, keeping the order of atoms in each slab
+ * 
+ * first: first bin of each slab and total number of bins, zeroed by caller
+ *        (nslabs + 1, output)
+ * lower: lower x plane reached by each atom
+ * upper: upper x plane reached by each atom
+ * order: atoms in binning order
+ * natoms: number of atoms
+ * nslabs: number of slabs
+ * 
+ * returns: atoms of each slab, from first[s] to first[s + 1] - 1
+ */
+int *bin_atoms(int *first, int *lower, int *upper, int *order, int natoms, int nslabs)
+{
+    int n, s, atom, *bins, *cursor;
+
+    for (atom = 0; atom < natoms; atom++)
+        for (s = lower[atom] >> BRICK_SHIFT; s <= upper[atom] >> BRICK_SHIFT; s++)
+            first[s + 1]++;
+    for (s = 0; s < nslabs; s++)
+        first[s + 1] += first[s];
+    bins = (int *)malloc((first[nslabs] + 1) * sizeof(int));
+    cursor = (int *)malloc((nslabs + 1) * sizeof(int));
+    memcpy(cursor, first, (nslabs + 1) * sizeof(int));
+    for (n = 0; n < natoms; n++)
+        for (atom = order[n], s = lower[atom] >> BRICK_SHIFT; s <= upper[atom] >> BRICK_SHIFT; s++)
+            bins[cursor[s]++] = atom;
+    free(cursor);
+
+    return bins;
+}
+
+/*
+ * Function: fill
+ * --------------
+ * 
+ * Insert atoms with a probe addition inside a 3D grid. Atoms are binned
+ * into x slabs one brick thick, an atom going to every slab it reaches,
+ * and each thread fills whole slabs, so no brick is written by two
+ * threads. Atoms sharing a radius bound their spans with the stencil of
+ * their radius class, up to MAX_CLASSES classes. Atom centers and radii
+ * are rounded to fixed point (16.16) and stencils are built for rounded
+ * radii, so stencil bounds and voxel tests agree exactly
+ * 
+ * grid: brick map
+ * projected: atoms in 3D grid coordinates
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void fill(brickmap *grid, projection *projected, double step, double probe, int nthreads)
+{
+    int c, s, n, atom, nclasses = 0, nslabs = grid->bx, nx = grid->nx, natoms = projected->natoms;
+    int *classes, *first, *bins, *lower, *upper, *order = projected->order;
+    int64_t *fixed;
+    double *centers = projected->centers;
+    stencil stencils[MAX_CLASSES];
+    int64_t radii[MAX_CLASSES];
+
+    fixed = (int64_t *)malloc(natoms * 4 * sizeof(int64_t));
+    classes = (int *)malloc(natoms * sizeof(int));
+    lower = (int *)malloc(natoms * sizeof(int));
+    upper = (int *)malloc(natoms * sizeof(int));
+    first = (int *)calloc(nslabs + 1, sizeof(int));
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(step, probe, natoms, nx, centers, fixed, lower, upper), private(atom)
+    {
+#pragma omp for schedule(static)
+        for (atom = 0; atom < natoms; atom++)
+        {
+            // Round atom center and radius (H) for space occupied by probe
+            // and atom to fixed point
+            fixed[atom * 4] = to_fixed(centers[atom * 4]);
+            fixed[1 + (atom * 4)] = to_fixed(centers[1 + (atom * 4)]);
+            fixed[2 + (atom * 4)] = to_fixed(centers[2 + (atom * 4)]);
+            fixed[3 + (atom * 4)] = to_fixed(grid_radius(centers[3 + (atom * 4)], step, probe));
+
+            // Get x planes reached by atom, covering its stencil extent
+            lower[atom] = FIXED_FLOOR(fixed[atom * 4] - fixed[3 + (atom * 4)]) - 1 > 0 ? FIXED_FLOOR(fixed[atom * 4] - fixed[3 + (atom * 4)]) - 1 : 0;
+            upper[atom] = FIXED_CEIL(fixed[atom * 4] + fixed[3 + (atom * 4)]) + 1 < nx - 1 ? FIXED_CEIL(fixed[atom * 4] + fixed[3 + (atom * 4)]) + 1 : nx - 1;
+        }
+    }
+
+    // Assign atoms to radius classes
+    for (atom = 0; atom < natoms; atom++)
+    {
+        for (c = 0; c < nclasses && radii[c] != fixed[3 + (atom * 4)]; c++)
+            ;
+        if (c == nclasses)
+        {
+            if (nclasses < MAX_CLASSES)
+                radii[nclasses++] = fixed[3 + (atom * 4)];
+            else
+                c = -1;
+        }
+        classes[atom] = c;
+    }
+
+#pragma omp parallel for default(none), shared(stencils, radii, nclasses), private(c), schedule(dynamic)
+    for (c = 0; c < nclasses; c++)
+        build_stencil(&stencils[c], (double)radii[c] / FIXED_ONE);
+
+    // Bin atoms into slabs reached, in Morton order of their centers so that
+    // atoms filled one after another in a slab share bricks
+    bins = bin_atoms(first, lower, upper, order, natoms, nslabs);
+
+#pragma omp parallel default(none), shared(grid, nslabs, nx, first, bins, classes, stencils, fixed), private(s, n, atom)
+    {
+#pragma omp for schedule(dynamic)
+        for (s = 0; s < nslabs; s++)
+            for (n = first[s]; n < first[s + 1]; n++)
+            {
+                atom = bins[n];
+                fill_atom(grid, classes[atom] < 0 ? NULL : &stencils[classes[atom]], fixed[atom * 4], fixed[1 + (atom * 4)], fixed[2 + (atom * 4)], fixed[3 + (atom * 4)], s << BRICK_SHIFT, ((s << BRICK_SHIFT) | BRICK_MASK) < nx - 1 ? ((s << BRICK_SHIFT) | BRICK_MASK) : nx - 1);
+            }
+    }
+
+    // Free stencils and bins
+    for (c = 0; c < nclasses; c++)
+        free(stencils[c].rows);
+    free(classes);
+    free(fixed);
+    free(lower);
+    free(upper);
+    free(first);
+    free(bins);
+}
+
+/* Distance field */
+
+/*
+ * Function: distance_atom
+ * -----------------------
+ * 
+ * Lower the distance field to the van der Waals surface of an atom inside
+ * the x planes of a slab, within a band around the atom
+ * 
+ * field: dense distance field (A)
+ * ny: y grid units
+ * nz: z grid units
+ * x: x grid coordinate of atom center
+ * y: y grid coordinate of atom center
+ * z: z grid coordinate of atom center
+ * radius: radius of atom (grid units)
+ * band: width of band outside atom (grid units)
+ * step: 3D grid spacing (A)
+ * first: first x plane of slab
+ * last: last x plane of slab
+ * 
+ */
+void distance_atom(float *field, int ny, int nz, double x, double y, double z, double radius, double band, double step, int first, int last)
+{
+    int i, j, k, imin, imax, jmin, jmax, kmin, kmax;
+    double R = radius + band, R2 = R * R, d2, w, d;
+    float *row;
+
+    // Clip band from atom center to slab
+    imin = floor(x - R) > first ? floor(x - R) : first;
+    imax = ceil(x + R) < last ? ceil(x + R) : last;
+    jmin = floor(y - R) > 0 ? floor(y - R) : 0;
+    jmax = ceil(y + R) < ny - 1 ? ceil(y + R) : ny - 1;
+
+    for (i = imin; i <= imax; i++)
+        for (j = jmin; j <= jmax; j++)
+        {
+            d2 = (i - x) * (i - x) + (j - y) * (j - y);
+            if (d2 >= R2)
+                continue;
+            w = sqrt(R2 - d2);
+            kmin = ceil(z - w) > 0 ? ceil(z - w) : 0;
+            kmax = floor(z + w) < nz - 1 ? floor(z + w) : nz - 1;
+            row = field + (size_t)nz * (j + (size_t)ny * i);
+            for (k = kmin; k <= kmax; k++)
+            {
+                d = (sqrt(d2 + (k - z) * (k - z)) - radius) * step;
+                if (d < row[k])
+                    row[k] = d;
+            }
+        }
+}
+
+/*
+ * Function: distance_field
+ * ------------------------
+ * 
+ * Define signed distance from each grid point to the van der Waals surface
+ * of the nearest atom (negative inside atoms), clamped to a cutoff. Atoms
+ * are binned into x slabs one brick thick, as in fill, so each thread
+ * writes whole slabs
+ * 
+ * field: dense distance field (A, output)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * projected: atoms in 3D grid coordinates
+ * step: 3D grid spacing (A)
+ * cutoff: largest distance kept (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void distance_field(float *field, int nx, int ny, int nz, projection *projected, double step, double cutoff, int nthreads)
+{
+    int i, s, n, atom, nslabs = (nx + BRICK_MASK) >> BRICK_SHIFT, natoms = projected->natoms;
+    int *first, *bins, *lower, *upper;
+    size_t plane = (size_t)ny * nz, v;
+    double *centers = projected->centers, *radii, band = cutoff / step;
+
+    radii = (double *)malloc(natoms * sizeof(double));
+    lower = (int *)malloc(natoms * sizeof(int));
+    upper = (int *)malloc(natoms * sizeof(int));
+    first = (int *)calloc(nslabs + 1, sizeof(int));
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(field, nx, plane, cutoff, step, band, natoms, centers, radii, lower, upper), private(i, v, atom)
+    {
+        // Clamp distances, with the static x partitioning placing planes
+#pragma omp for schedule(static)
+        for (i = 0; i < nx; i++)
+            for (v = 0; v < plane; v++)
+                field[i * plane + v] = cutoff;
+
+#pragma omp for schedule(static)
+        for (atom = 0; atom < natoms; atom++)
+        {
+            // Radius of atom in grid units, and x planes reached by its band
+            radii[atom] = centers[3 + (atom * 4)] / step;
+            lower[atom] = floor(centers[atom * 4] - radii[atom] - band) > 0 ? floor(centers[atom * 4] - radii[atom] - band) : 0;
+            upper[atom] = ceil(centers[atom * 4] + radii[atom] + band) < nx - 1 ? ceil(centers[atom * 4] + radii[atom] + band) : nx - 1;
+        }
+    }
+
+    bins = bin_atoms(first, lower, upper, projected->order, natoms, nslabs);
+
+#pragma omp parallel default(none), shared(field, nx, ny, nz, nslabs, first, bins, centers, radii, band, step), private(s, n, atom)
+    {
+#pragma omp for schedule(dynamic)
+        for (s = 0; s < nslabs; s++)
+            for (n = first[s]; n < first[s + 1]; n++)
+            {
+                atom = bins[n];
+                distance_atom(field, ny, nz, centers[atom * 4], centers[1 + (atom * 4)], centers[2 + (atom * 4)], radii[atom], band, step, s << BRICK_SHIFT, ((s << BRICK_SHIFT) | BRICK_MASK) < nx - 1 ? ((s << BRICK_SHIFT) | BRICK_MASK) : nx - 1);
+            }
+    }
+
+    free(radii);
+    free(lower);
+    free(upper);
+    free(first);
+    free(bins);
+}
+
+/*
+ * Function: threshold_field
+ * -------------------------
+ * 
+ * Insert grid points closer than a probe to the van der Waals surface of
+ * an atom inside a 3D grid, as spans of z rows. It matches fill with the
+ * same probe, up to points within rounding of an atom boundary. Probe is
+ * compared in single precision, as the distance field is initialized to its
+ * cutoff
+ * 
+ * grid: brick map
+ * field: dense distance field (A)
+ * probe: Probe size (A), up to the cutoff of the distance field
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void threshold_field(brickmap *grid, float *field, double probe, int nthreads)
+{
+    int i, j, k, kmin, s, nx = grid->nx, ny = grid->ny, nz = grid->nz, nslabs = grid->bx;
+    float *row, cut = (float)probe;
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, field, cut, nx, ny, nz, nslabs), private(s, i, j, k, kmin, row)
+    {
+#pragma omp for schedule(dynamic)
+        for (s = 0; s < nslabs; s++)
+            for (i = s << BRICK_SHIFT; i <= ((s << BRICK_SHIFT) | BRICK_MASK) && i < nx; i++)
+                for (j = 0; j < ny; j++)
+                {
+                    row = field + (size_t)nz * (j + (size_t)ny * i);
+                    for (k = 0; k < nz; k++)
+                        if (row[k] < cut)
+                        {
+                            for (kmin = k; k + 1 < nz && row[k + 1] < cut; k++)
+                                ;
+                            fill_row(grid, i, j, kmin, k);
+                        }
+                }
+    }
+}
+
+/*
+ * Function: _distance
+ * -------------------
+ * 
+ * Define distance field of a target biomolecule into an array allocated
+ * here and handed over to the caller, who releases it with free
+ * 
+ * field: signed distance (A) from each grid point to the van der Waals
+ *        surface of the nearest atom, clamped to cutoff (output)
+ * dx: x grid units (output)
+ * dy: y grid units (output)
+ * dz: z grid units (output)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * cutoff: largest distance kept (A)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void _distance(float **field, int *dx, int *dy, int *dz, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double cutoff, int nthreads, int verbose)
+{
+    projection projected;
+
+    if (verbose)
+        fprintf(stdout, "> Defining distance field\n");
+
+    iprojection(&projected);
+    project_atoms(&projected, atoms, natoms, reference, sincos, step, nthreads);
+
+    // Allocate output with the grid allocator, ownership passes to the caller
+    *field = (float *)huge_alloc((size_t)nx * ny * nz * sizeof(float));
+    distance_field(*field, nx, ny, nz, &projected, step, cutoff, nthreads);
+    free_projection(&projected);
+
+    *dx = nx;
+    *dy = ny;
+    *dz = nz;
+}
+
+/* Biomolecular surface representation */
+
+/*
+ * Function: ses
+ * --------------
+ * 
+ * Adjust surface representation to Solvent Excluded Surface (SES)
+ * 
+ * grid: brick map
+ * protein: occupancy bricks reused for protein points
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void ses(brickmap *grid, bitbricks *protein, double step, double probe, int nthreads)
+{
+    int b, s, bi, bj, bk, x, bit, i, j, k, i2, j2, k2, kmin, kmax, kend, aux, width, *extent, nx = grid->nx, ny = grid->ny, nz = grid->nz;
+    uint64_t word, dilated[BRICK];
+    signed char *voxels, *voxels2;
+
+    // Calculate sas limit in 3D grid units
+    aux = ceil(probe / step);
+
+    // Tabulate sas limit extent along z for each (x, y) offset of the
+    // probe ball (-1: no point of the row is inside sas limit)
+    width = 2 * aux + 1;
+    extent = (int *)malloc(width * width * sizeof(int));
+    for (i2 = -aux; i2 <= aux; i2++)
+        for (j2 = -aux; j2 <= aux; j2++)
+        {
+            extent[(j2 + aux) + width * (i2 + aux)] = -1;
+            for (k2 = 0; k2 <= aux; k2++)
+                if (sqrt(pow(i2, 2) + pow(j2, 2) + pow(k2, 2)) < (probe / step))
+                    extent[(j2 + aux) + width * (i2 + aux)] = k2;
+        }
+
+    // Pack protein points (0 or -2). Protein points only change from 0 to
+    // -2 below, so they are packed once from 0.
+    pack_bricks(grid, 0, protein, nthreads);
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, protein, extent, aux, width, nx, ny, nz, replace_label), private(b, s, bi, bj, bk, x, bit, word, dilated, voxels, voxels2, i, j, k, i2, j2, k2, kmin, kmax, kend)
+    {
+#pragma omp for schedule(dynamic)
+        // Loop around bricks with cavity points
+        for (b = 0; b < grid->nbricks; b++)
+        {
+            if (!has_label(grid, b, 1))
+                continue;
+
+            // Mark cavity points next to protein points
+            bi = b / (grid->by * grid->bz);
+            bj = (b / grid->bz) % grid->by;
+            bk = b % grid->bz;
+            if (!dilate_brick(grid, protein, bi, bj, bk, dilated))
+                continue;
+            voxels = brick_voxels(grid, b);
+
+            for (x = 0; x < BRICK; x++)
+                for (word = dilated[x]; word; word &= word - 1)
+                {
+                    // Check if a cavity point
+                    bit = __builtin_ctzll(word);
+                    if (voxels != NULL && voxels[bit + BRICK * BRICK * x] != 1)
+                        continue;
+                    i = (bi << BRICK_SHIFT) + x;
+                    j = (bj << BRICK_SHIFT) + (bit >> BRICK_SHIFT);
+                    k = (bk << BRICK_SHIFT) + (bit & BRICK_MASK);
+
+                    // Loop around sas limit from cavity point next to protein point
+                    for (i2 = i - aux; i2 <= i + aux; i2++)
+                    {
+                        if (i2 <= 0 || i2 >= nx)
+                            continue;
+                        for (j2 = j - aux; j2 <= j + aux; j2++)
+                        {
+                            if (j2 <= 0 || j2 >= ny || extent[(j2 - j + aux) + width * (i2 - i + aux)] < 0)
+                                continue;
+
+                            // Inspect row inside sas limit, one brick segment at a time
+                            kmin = k - extent[(j2 - j + aux) + width * (i2 - i + aux)];
+                            kmax = k + extent[(j2 - j + aux) + width * (i2 - i + aux)];
+                            kmin = kmin > 1 ? kmin : 1;
+                            kmax = kmax < nz - 1 ? kmax : nz - 1;
+                            for (k2 = kmin; k2 <= kmax; k2 = kend + 1)
+                            {
+                                kend = (k2 | BRICK_MASK) < kmax ? (k2 | BRICK_MASK) : kmax;
+
+                                // Uniform bricks have protein points only when buried
+                                voxels2 = brick_voxels(grid, BRICK_INDEX(grid, i2, j2, k2));
+                                if (voxels2 == NULL)
+                                {
+                                    if (grid->uniform[BRICK_INDEX(grid, i2, j2, k2)] != 0)
+                                        continue;
+                                    voxels2 = allocate_brick(grid, BRICK_INDEX(grid, i2, j2, k2));
+                                }
+
+                                // Mark cavity points
+                                replace_lanes(voxels2 + BRICK_OFFSET(i2, j2, 0), k2 & BRICK_MASK, kend & BRICK_MASK, 0, -2);
+                            }
+                        }
+                    }
+                }
+        }
+
+#pragma omp for schedule(static)
+        // Loop around allocated bricks
+        for (s = 0; s < grid->nslots; s++)
+        {
+            // Mark space occupied by sas limit from protein surface
+            replace_label(SLOT_VOXELS(grid, s), BRICK_VOXELS, -2, 1);
+        }
+    }
+
+    free(extent);
+}
+
+/* Surface points detection */
+
+/*
+ * Function: filter_surface
+ * ------------------------
+ * 
+ * Inspect 3D grid and mark detected surface points on a surface 3D grid.
+ * Cavity points next to a biomolecule point (0) are surface points (1) and
+ * remaining cavity points are solvent points (-1).
+ * 
+ * grid: brick map
+ * biomolecule: occupancy bricks reused for biomolecule points
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void filter_surface(brickmap *grid, bitbricks *biomolecule, int nthreads)
+{
+    int b;
+
+    // Pack biomolecule points
+    pack_bricks(grid, 0, biomolecule, nthreads);
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, biomolecule), private(b)
+    {
+#pragma omp for schedule(dynamic, 16)
+        for (b = 0; b < grid->nbricks; b++)
+            // Define surface cavity points
+            filter_brick(grid, biomolecule, b, 1, -1);
+    }
+}
+
+/* Enclosed points removal */
+
+/*
+ * Function: filter_noise_points
+ * -----------------------------
+ * 
+ * Inspect 3D grid and remove enclosed points on a surface 3D grid. Surface
+ * points (1) without a neighbouring solvent point (-1) are converted to
+ * biomolecule points (0).
+ * 
+ * grid: brick map
+ * solvent: occupancy bricks reused for solvent points
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void filter_noise_points(brickmap *grid, bitbricks *solvent, int nthreads)
+{
+    int b;
+
+    // Pack solvent points
+    pack_bricks(grid, -1, solvent, nthreads);
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, solvent), private(b)
+    {
+#pragma omp for schedule(dynamic, 16)
+        for (b = 0; b < grid->nbricks; b++)
+            // Remove enclosed regions
+            filter_brick(grid, solvent, b, 1, 0);
+    }
+}
+
+/* Enclosed points removal - flood and fill algorithm */
+
+/*
+ * Cluster labels
+ * --------------
+ * 
+ * Narrow-label grid cannot store one integer tag per cluster, so clusters
+ * are identified by three labels and the voxels of the cluster under
+ * construction are kept in a side list (see cluster struct)
+ * 
+ * FIRST_CLUSTER: first cluster found (solvent-exposed surface points)
+ * ENCLOSED_CLUSTER: finished clusters after the first (enclosed points)
+ * CURRENT_CLUSTER: cluster under construction after the first
+ * 
+ */
+#define FIRST_CLUSTER 2
+#define ENCLOSED_CLUSTER 3
+#define CURRENT_CLUSTER 4
+
+/*
+ * Variable: points
+ * ----------------
+ * 
+ * Accumulate number of points while clustering surface points
+ * 
+ */
+int points;
+
+/*
+ * Variable: big
+ * 
+ * Flag that marks big surfaces on clustering
+ * 
+ */
+int big;
+
+/*
+ * Struct: cluster
+ * ---------------
+ * 
+ * Side list with voxel addresses of the cluster under construction
+ * 
+ * voxels: voxel addresses in brick map
+ * size: number of voxel addresses
+ * capacity: allocated number of voxel addresses
+ * 
+ */
+typedef struct cluster
+{
+    signed char **voxels;
+    int size;
+    int capacity;
+} cluster;
+
+/*
+ * Function: append
+ * ----------------
+ * 
+ * Append a voxel address to the side list of a cluster
+ * 
+ * members: side list of cluster under construction
+ * voxel: voxel address in brick map
+ * 
+ */
+void append(cluster *members, signed char *voxel)
+{
+    if (members->size == members->capacity)
+    {
+        members->capacity = members->capacity ? 2 * members->capacity : 1024;
+        members->voxels = (signed char **)realloc(members->voxels, members->capacity * sizeof(signed char *));
+    }
+    members->voxels[members->size++] = voxel;
+}
+
+/*
+ * Function: check_unclustered_neighbours
+ * --------------------------------------
+ * 
+ * Checks if a surface point on the grid is next to a clustered surface point (> 1)
+ * 
+ * grid: brick map
+ * i: x coordinate of point
+ * j: y coordinate of point
+ * k: z coordinate of point
+ * 
+ * returns: cluster label of neighbour (int > 1) or false (int 0)
+ */
+int check_unclustered_neighbours(brickmap *grid, int i, int j, int k)
+{
+    int x, y, z;
+    signed char label;
+
+    // Loop around neighboring points
+    for (x = i - 1; x <= i + 1; x++)
+        for (y = j - 1; y <= j + 1; y++)
+            for (z = k - 1; z <= k + 1; z++)
+            {
+                // Check if point is inside 3D grid
+                if (x < 0 || y < 0 || z < 0 || x > grid->nx - 1 || y > grid->ny - 1 || z > grid->nz - 1)
+                    ;
+                else if ((label = get_voxel(grid, x, y, z)) > 1)
+                    return label;
+            }
+    return 0;
+}
+
+/*
+ * Function: flood_and_fill
+ * ------------------------
+ * 
+ * Recursive flood and fill algorithm
+ * 
+ * grid: brick map
+ * i: x coordinate of point
+ * j: y coordinate of point
+ * k: z coordinate of point
+ * tag: cluster label (FIRST_CLUSTER or CURRENT_CLUSTER)
+ * members: side list of cluster under construction
+ * 
+ */
+void flood_and_fill(brickmap *grid, int i, int j, int k, signed char tag, cluster *members)
+{
+    int x, y, z;
+    signed char *voxel;
+
+    if (i == 0 || i == grid->nx - 1 || j == 0 || j == grid->ny - 1 || k == 0 || k == grid->nz - 1)
+        return;
+
+    if (get_voxel(grid, i, j, k) == 1 && !big)
+    {
+        voxel = voxel_address(grid, i, j, k);
+        *voxel = tag;
+        points++;
+
+        // Keep track of points that must be relabelled when cluster is finished
+        if (tag == CURRENT_CLUSTER)
+            append(members, voxel);
+
+        if (points == 10000)
+            big = 1;
+
+        if (!big)
+        {
+            for (x = i - 1; x <= i + 1; x++)
+                for (y = j - 1; y <= j + 1; y++)
+                    for (z = k - 1; z <= k + 1; z++)
+                        flood_and_fill(grid, x, y, z, tag, members);
+        }
+    }
+}
+
+/*
+ * Function: filter_enclosed_regions
+ * ---------------------------------
+ * 
+ * Cluster consecutive surface points together and remove enclosed surface points
+ * 
+ * grid: brick map
+ * members: cluster members reused between clusters
+ * step: 3D grid spacing (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void filter_enclosed_regions(brickmap *grid, cluster *members, double step, int nthreads)
+{
+    int i, j, k, i2, j2, k2, n, s, v, tag, aux, nx = grid->nx, ny = grid->ny, nz = grid->nz;
+    signed char label, *voxels;
+
+    // Set number of threads in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+    // Initialize variables
+    tag = 1;
     aux = 0;
     big = 0;
 
-    for (i = 0; i < nx; i++)
-        for (j = 0; j < ny; j++)
-            for (k = 0; k < nz; k++)
-                if (grid[k + nz * (j + (ny * i))] == 1)
-                {
-                    tag++;
-                    points = 0;
+    for (i = 0; i < nx; i++)
+        for (j = 0; j < ny; j++)
+            for (k = 0; k < nz; k++)
+            {
+                // Skip bricks without surface points
+                if (!(k & BRICK_MASK) && !has_label(grid, BRICK_INDEX(grid, i, j, k), 1))
+                {
+                    k += BRICK_MASK;
+                    continue;
+                }
+
+                if (get_voxel(grid, i, j, k) == 1)
+                {
+                    tag++;
+                    points = 0;
+                    members->size = 0;
+
+                    // First cluster is the solvent-exposed surface
+                    label = (tag == 2) ? FIRST_CLUSTER : CURRENT_CLUSTER;
+
+                    // Clustering procedure
+                    flood_and_fill(grid, i, j, k, label, members);
+                    aux = points;
+
+                    // Loop for big cavities
+                    while (big)
+                    {
+                        aux = 0;
+
+                        for (i2 = 0; i2 < nx; i2++)
+                            for (j2 = 0; j2 < ny; j2++)
+                                for (k2 = 0; k2 < nz; k2++)
+                                {
+                                    big = 0;
+                                    aux += points;
+                                    points = 0;
+
+                                    // Skip bricks without surface points
+                                    if (!(k2 & BRICK_MASK) && !has_label(grid, BRICK_INDEX(grid, i2, j2, k2), 1))
+                                    {
+                                        k2 += BRICK_MASK;
+                                        continue;
+                                    }
+
+                                    if (get_voxel(grid, i2, j2, k2) == 1 && check_unclustered_neighbours(grid, i2, j2, k2) == label)
+                                        flood_and_fill(grid, i2, j2, k2, label, members);
+                                }
+                    }
+                    points = aux;
+
+                    // Finished cluster is enclosed
+                    for (n = 0; n < members->size; n++)
+                        *members->voxels[n] = ENCLOSED_CLUSTER;
+                }
+            }
+
+    // Convert labels
+    // * 2 -> 1
+    // * 3 -> 0
+    if (tag > 1)
+    {
+#pragma omp parallel default(none), shared(grid), private(s, v, voxels)
+        {
+#pragma omp for schedule(static)
+            for (s = 0; s < grid->nslots; s++)
+            {
+                voxels = SLOT_VOXELS(grid, s);
+                for (v = 0; v < BRICK_VOXELS; v++)
+                {
+                    if (voxels[v] == FIRST_CLUSTER)
+                        voxels[v] = 1;
+                    else if (voxels[v] > FIRST_CLUSTER)
+                        voxels[v] = 0;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Struct: workspace
+ * -----------------
+ * 
+ * Grow-only buffers reused between surface definitions
+ * 
+ * grid: brick map and brick pool
+ * bits: occupancy bricks
+ * members: cluster members
+ * projected: atoms of the last surface definition in 3D grid coordinates
+ * 
+ */
+typedef struct workspace
+{
+    brickmap grid;
+    bitbricks bits;
+    cluster members;
+    projection projected;
+} workspace;
+
+/*
+ * Function: iworkspace
+ * --------------------
+ * 
+ * Initialize workspace for a 3D grid and select SIMD kernels
+ * 
+ * ws: workspace
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * placement: NUMA placement policy (FIRST_TOUCH or INTERLEAVE)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void iworkspace(workspace *ws, int nx, int ny, int nz, int placement, int nthreads)
+{
+    select_kernels();
+    igrid(&ws->grid, nx, ny, nz, placement, nthreads);
+    ibits(&ws->bits);
+    ws->members.voxels = NULL;
+    ws->members.size = 0;
+    ws->members.capacity = 0;
+    iprojection(&ws->projected);
+}
+
+/*
+ * Function: free_workspace
+ * ------------------------
+ * 
+ * Free workspace buffers
+ * 
+ * ws: workspace
+ * 
+ */
+void free_workspace(workspace *ws)
+{
+    free_grid(&ws->grid);
+    free_bits(&ws->bits);
+    free(ws->members.voxels);
+    free_projection(&ws->projected);
+}
+
+/*
+ * Function: _create_workspace
+ * ---------------------------
+ * 
+ * Create an empty workspace to reuse between surface definitions
+ * 
+ * returns: workspace
+ */
+workspace *_create_workspace(void)
+{
+    workspace *ws = (workspace *)malloc(sizeof(workspace));
+
+    iworkspace(ws, 0, 0, 0, FIRST_TOUCH, 1);
+
+    return ws;
+}
+
+/*
+ * Function: _destroy_workspace
+ * ----------------------------
+ * 
+ * Destroy a workspace created by _create_workspace
+ * 
+ * ws: workspace
+ * 
+ */
+void _destroy_workspace(workspace *ws)
+{
+    free_workspace(ws);
+    free(ws);
+}
+
+/*
+ * Function: shape_surface
+ * -----------------------
+ * 
+ * Define solvent-exposed surface on the brick map of a workspace, once
+ * biomolecule points with a probe addition are inserted
+ * 
+ * ws: workspace
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void shape_surface(workspace *ws, double step, double probe, int is_ses, int morton, int nthreads, int verbose)
+{
+    collapse_bricks(&ws->grid, nthreads);
+    if (morton)
+        order_bricks(&ws->grid, nthreads);
+
+    if (is_ses)
+    {
+        if (verbose)
+            fprintf(stdout, "> Adjusting SES surface\n");
+        ses(&ws->grid, &ws->bits, step, probe, nthreads);
+        collapse_bricks(&ws->grid, nthreads);
+        if (morton)
+            order_bricks(&ws->grid, nthreads);
+    }
+
+    if (verbose)
+        fprintf(stdout, "> Defining surface points\n");
+    filter_surface(&ws->grid, &ws->bits, nthreads);
+    collapse_bricks(&ws->grid, nthreads);
+
+    if (verbose)
+        fprintf(stdout, "> Filtering enclosed regions\n");
+    filter_enclosed_regions(&ws->grid, &ws->members, step, nthreads);
+    filter_noise_points(&ws->grid, &ws->bits, nthreads);
+}
+
+/*
+ * Function: define_surface
+ * ------------------------
+ * 
+ * Define solvent-exposed surface from a target biomolecule on the brick map
+ * of a workspace
+ * 
+ * ws: workspace
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void define_surface(workspace *ws, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int morton, int nthreads, int verbose)
+{
+    if (verbose)
+        if (!is_ses)
+            fprintf(stdout, "> Adjusting SAS surface\n");
+    project_atoms(&ws->projected, atoms, natoms, reference, sincos, step, nthreads);
+    fill(&ws->grid, &ws->projected, step, probe, nthreads);
+    shape_surface(ws, step, probe, is_ses, morton, nthreads, verbose);
+}
+
+/*
+ * Function: _surface
+ * ------------------
+ * 
+ * Define solvent-exposed surface from a target biomolecule into a 3D grid
+ * allocated here and handed over to the caller, who releases it with free
+ * 
+ * grid: surface 3D grid (output)
+ * dx: x dimension of surface 3D grid (output)
+ * dy: y dimension of surface 3D grid (output)
+ * dz: z dimension of surface 3D grid (output)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * placement: NUMA placement policy (0: first-touch or 1: interleave)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void _surface(signed char **grid, int *dx, int *dy, int *dz, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose)
+{
+    workspace ws;
+    size_t size = (size_t)nx * ny * nz;
+
+    iworkspace(&ws, nx, ny, nz, placement, nthreads);
+    define_surface(&ws, atoms, natoms, xyzr, reference, ndims, sincos, nvalues, step, probe, is_ses, morton, nthreads, verbose);
 
-                    // Clustering procedure
-                    flood_and_fill(grid, nx, ny, nz, i, j, k, tag);
-                    aux = points;
+    // Allocate output with the grid allocator, ownership passes to the caller
+    *grid = (signed char *)huge_alloc(size * sizeof(signed char));
+    place_memory(*grid, size * sizeof(signed char), placement);
+    export_grid(&ws.grid, *grid, 0, nthreads);
+    free_workspace(&ws);
 
-                    // Loop for big cavities
-                    while (big)
-                    {
-                        aux = 0;
+    *dx = nx;
+    *dy = ny;
+    *dz = nz;
+}
 
-                        for (i2 = 0; i2 < nx; i2++)
-                            for (j2 = 0; j2 < ny; j2++)
-                                for (k2 = 0; k2 < nz; k2++)
-                                {
-                                    big = 0;
-                                    aux += points;
-                                    points = 0;
-                                    if (grid[k2 + nz * (j2 + (ny * i2))] == 1 && check_unclustered_neighbours(grid, nx, ny, nz, i2, j2, k2) == tag)
-                                        flood_and_fill(grid, nx, ny, nz, i2, j2, k2, tag);
-                                }
-                    }
-                    points = aux;
-                }
+/*
+ * Function: _mapped_surface
+ * -------------------------
+ * 
+ * Define solvent-exposed surface from a target biomolecule into a
+ * memory-mapped 3D grid, with brick storage paged to a scratch file
+ * 
+ * mapped: memory-mapped surface 3D grid
+ * size: number of voxels (nx * ny * nz)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * placement: NUMA placement policy (0: first-touch or 1: interleave)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
+ * scratch: directory for brick storage scratch file (NULL or empty: anonymous memory)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ * returns: 0 on success or -1 if size does not match grid units
+ */
+int _mapped_surface(signed char *mapped, size_t size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, char *scratch, int nthreads, int verbose)
+{
+    workspace ws;
 
-    // Convert tags
-    // * 2 -> 1
-    // * >2 -> -1
-    if (tag > 1)
-    {
-#pragma omp parallel default(none), shared(grid, nx, ny, nz), private(i, j, k)
-        {
-#pragma omp for collapse(3) schedule(static)
-            for (i = 0; i < nx; i++)
-                for (j = 0; j < ny; j++)
-                    for (k = 0; k < nz; k++)
-                    {
-                        if (grid[k + nz * (j + (ny * i))] == 2)
-                            grid[k + nz * (j + (ny * i))] = 1;
-                        else if (grid[k + nz * (j + (ny * i))] > 2)
-                            grid[k + nz * (j + (ny * i))] = 0;
-                    }
-        }
-    }
+    if (size != (size_t)nx * ny * nz)
+        return -1;
+
+    iworkspace(&ws, nx, ny, nz, placement, nthreads);
+    map_grid(&ws.grid, scratch);
+    define_surface(&ws, atoms, natoms, xyzr, reference, ndims, sincos, nvalues, step, probe, is_ses, morton, nthreads, verbose);
+    export_grid(&ws.grid, mapped, 1, nthreads);
+    free_workspace(&ws);
+
+    return 0;
 }
 
 /*
- * Function: _surface
- * ------------------
+ * Function: _workspace_surface
+ * ----------------------------
  * 
- * Define solvent-exposed surface from a target biomolecule
+ * Define solvent-exposed surface from a target biomolecule reusing the
+ * buffers of a workspace
  * 
- * grid: surface 3D grid
+ * ws: workspace
+ * buffer: surface 3D grid
+ * size: number of voxels (nx * ny * nz)
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
@@ -542,116 +2998,438 @@ void filter_enclosed_regions(int *grid, int nx, int ny, int nz, double step, int
  * step: 3D grid spacing (A)
  * probe: Probe size (A)
  * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * placement: NUMA placement policy (0: first-touch or 1: interleave)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
  * nthreads: number of threads for OpenMP
  * verbose: print extra information to standard output
  * 
+ * returns: 0 on success or -1 if size does not match grid units
  */
-void _surface(int *grid, int size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int nthreads, int verbose)
+int _workspace_surface(workspace *ws, signed char *buffer, size_t size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose)
 {
+    if (size != (size_t)nx * ny * nz)
+        return -1;
 
-    if (verbose)
-        if (!is_ses)
-            fprintf(stdout, "> Adjusting SAS surface\n");
-    igrid(grid, size);
-    fill(grid, nx, ny, nz, atoms, natoms, xyzr, reference, ndims, sincos, nvalues, step, probe, nthreads);
+    ws->grid.placement = placement;
+    resize_grid(&ws->grid, nx, ny, nz, nthreads);
+    define_surface(ws, atoms, natoms, xyzr, reference, ndims, sincos, nvalues, step, probe, is_ses, morton, nthreads, verbose);
+    export_grid(&ws->grid, buffer, 0, nthreads);
 
-    if (is_ses)
+    return 0;
+}
+
+/*
+ * Function: _rle_surface
+ * ----------------------
+ * 
+ * Define solvent-exposed surface from a target biomolecule as a run-length
+ * encoded 3D grid (runs along z of each (x, y) row)
+ * 
+ * offsets: first run of each row and total number of runs
+ * noffsets: number of row offsets (nx * ny + 1)
+ * runs: label of each run
+ * nruns: number of runs
+ * lengths: number of voxels of each run
+ * nlengths: number of runs
+ * ws: workspace to reuse (NULL: temporary workspace)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * is_ses: surface mode (1: SES/VDW or 0: SAS)
+ * placement: NUMA placement policy (0: first-touch or 1: interleave)
+ * morton: order brick pool in Morton order of bricks (1) or not (0)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void _rle_surface(int **offsets, int *noffsets, signed char **runs, int *nruns, int **lengths, int *nlengths, workspace *ws, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose)
+{
+    workspace temporary;
+
+    if (ws == NULL)
     {
-        if (verbose)
-            fprintf(stdout, "> Adjusting SES surface\n");
-        ses(grid, nx, ny, nz, step, probe, nthreads);
+        ws = &temporary;
+        iworkspace(ws, nx, ny, nz, placement, nthreads);
+    }
+    else
+    {
+        ws->grid.placement = placement;
+        resize_grid(&ws->grid, nx, ny, nz, nthreads);
     }
 
-    if (verbose)
-        fprintf(stdout, "> Defining surface points\n");
-    filter_surface(grid, nx, ny, nz, nthreads);
+    define_surface(ws, atoms, natoms, xyzr, reference, ndims, sincos, nvalues, step, probe, is_ses, morton, nthreads, verbose);
+    *nruns = *nlengths = encode_grid(&ws->grid, offsets, runs, lengths, nthreads);
+    *noffsets = nx * ny + 1;
 
-    if (verbose)
-        fprintf(stdout, "> Filtering enclosed regions\n");
-    filter_enclosed_regions(grid, nx, ny, nz, step, nthreads);
-    filter_noise_points(grid, nx, ny, nz, nthreads);
+    if (ws == &temporary)
+        free_workspace(ws);
 }
 
-/* Solvent-exposed residues detection */
+/* Surface grid cache */
+
+#define CACHE_MAGIC "SERD"
+#define CACHE_VERSION 1
+#define CACHE_BUFFER ((size_t)1 << 20)
+#define CACHE_DIMS 124
+#define CACHE_RUNS 136
 
 /*
- * Struct: node
- * ------------
+ * Function: put_run
+ * -----------------
  * 
- * A linked list node for atom index in xyzr array
+ * Encode a run as its label followed by its length in 7-bit groups, least
+ * significant first, with the high bit set on all groups but the last
  * 
- * pos: atom index in xyzr array (coordinates and radii of pdb)
- * struct node* next: pointer to next linked list node
- *  
+ * buffer: output buffer
+ * label: label of run
+ * length: number of voxels of run
+ * 
+ * returns: number of bytes written
  */
-typedef struct node
+static inline size_t put_run(unsigned char *buffer, signed char label, size_t length)
 {
-    int pos;
-    struct node *next;
-} res;
+    size_t n = 0;
+
+    buffer[n++] = (unsigned char)label;
+    while (length >= 0x80)
+    {
+        buffer[n++] = (unsigned char)(length | 0x80);
+        length >>= 7;
+    }
+    buffer[n++] = (unsigned char)length;
+
+    return n;
+}
 
 /*
- * Function: create
- * ----------------
+ * Function: max_runs_length
+ * -------------------------
+ * 
+ * Bound the number of voxels that runs encoded by put_run can hold in a
+ * payload, when a single run takes all length bytes left over by the others
+ * 
+ * n: number of bytes of payload
+ * nruns: number of runs
+ * 
+ * returns: maximum number of voxels, 0 if the payload cannot hold the runs
+ */
+static size_t max_runs_length(size_t n, int64_t nruns)
+{
+    size_t bits, length;
+
+    // Each run takes a label and at least one length byte
+    if (nruns <= 0 || (uint64_t)nruns > n / 2)
+        return 0;
+    bits = 7 * (n - 2 * (size_t)nruns + 1);
+    if (bits >= 64)
+        return SIZE_MAX;
+    length = ((size_t)1 << bits) - 1;
+
+    if ((uint64_t)(nruns - 1) > (SIZE_MAX - length) / 0x7F)
+        return SIZE_MAX;
+    return length + (size_t)(nruns - 1) * 0x7F;
+}
+
+/*
+ * Function: _save_surface
+ * -----------------------
  * 
- * Create a res node
+ * Write a surface 3D grid to a cache file. A fixed header (magic, version,
+ * vertices, step, probe, representation, grid units and number of runs) is
+ * followed by the run-length encoded labels of the flattened grid
  * 
- * pos: atom index in xyzr array (coordinates and radii of pdb)
+ * grid: surface 3D grid
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * vertices: xyz coordinates of 3D grid vertices (origin, X-axis, Y-axis, Z-axis)
+ * nvertices: number of vertices (4)
+ * ncoords: number of coordinates (3: xyz)
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * representation: surface representation (0: VDW, 1: SES or 2: SAS)
+ * fn: path to cache file
  * 
- * returns: res node with atom index
+ * returns: 0 on success or -1 on failure
  */
-res *create(int pos)
+int _save_surface(signed char *grid, int nx, int ny, int nz, double *vertices, int nvertices, int ncoords, double step, double probe, int representation, char *fn)
 {
-    res *new = (res *)malloc(sizeof(res));
+    FILE *file;
+    unsigned char *buffer;
+    size_t i, j, n, size = (size_t)nx * ny * nz;
+    int64_t nruns = 0;
+    int version = CACHE_VERSION, dims[3] = {nx, ny, nz}, status = 0;
+
+    if (nvertices * ncoords != 12)
+        return -1;
+    if ((file = fopen(fn, "wb")) == NULL)
+        return -1;
+    buffer = (unsigned char *)malloc(CACHE_BUFFER);
+
+    // Header, with number of runs rewritten at the end
+    if (fwrite(CACHE_MAGIC, 1, 4, file) != 4 ||
+        fwrite(&version, sizeof(int), 1, file) != 1 ||
+        fwrite(vertices, sizeof(double), 12, file) != 12 ||
+        fwrite(&step, sizeof(double), 1, file) != 1 ||
+        fwrite(&probe, sizeof(double), 1, file) != 1 ||
+        fwrite(&representation, sizeof(int), 1, file) != 1 ||
+        fwrite(dims, sizeof(int), 3, file) != 3 ||
+        fwrite(&nruns, sizeof(int64_t), 1, file) != 1)
+    {
+        fclose(file);
+        free(buffer);
+        return -1;
+    }
+
+    // Payload
+    n = 0;
+    for (i = 0; i < size; i = j)
+    {
+        for (j = i + 1; j < size && grid[j] == grid[i]; j++)
+            ;
+        n += put_run(buffer + n, grid[i], j - i);
+        nruns++;
+
+        // Flush buffer before it can no longer hold a run
+        if (n > CACHE_BUFFER - 16)
+        {
+            if (fwrite(buffer, 1, n, file) != n)
+                status = -1;
+            n = 0;
+        }
+    }
+    if (fwrite(buffer, 1, n, file) != n)
+        status = -1;
 
-    new->pos = pos;
-    new->next = NULL;
+    if (fseek(file, CACHE_RUNS, SEEK_SET) != 0 || fwrite(&nruns, sizeof(int64_t), 1, file) != 1)
+        status = -1;
+    if (fclose(file) != 0)
+        status = -1;
+    free(buffer);
 
-    return new;
+    return status;
 }
 
 /*
- * Function: insert
- * ----------------
+ * Function: _load_surface
+ * -----------------------
  * 
- * Insert res node in linked list
+ * Read a surface 3D grid from a cache file written by _save_surface into a
+ * 3D grid allocated here and handed over to the caller, who releases it
+ * with free. On failure, the grid is empty
  * 
- * res: pointer to linked list head
- * new: res node
+ * grid: surface 3D grid (output)
+ * dx: x dimension of surface 3D grid (output)
+ * dy: y dimension of surface 3D grid (output)
+ * dz: z dimension of surface 3D grid (output)
+ * fn: path to cache file
  * 
+ * returns: 0 on success or -1 on failure
  */
-void insert(res **head, res *res_new)
+int _load_surface(signed char **grid, int *dx, int *dy, int *dz, char *fn)
 {
-    res *current;
+    FILE *file;
+    char magic[4];
+    unsigned char *payload = NULL;
+    size_t n, p, v, length, size = 0;
+    long start, end;
+    int64_t r, nruns;
+    int version, dims[3] = {0, 0, 0}, shift, status = -1;
+    signed char label;
+
+    *grid = NULL;
+    if ((file = fopen(fn, "rb")) != NULL)
+    {
+        // Header, skipping vertices, step, probe and representation
+        if (fread(magic, 1, 4, file) == 4 && memcmp(magic, CACHE_MAGIC, 4) == 0 &&
+            fread(&version, sizeof(int), 1, file) == 1 && version == CACHE_VERSION &&
+            fseek(file, CACHE_DIMS, SEEK_SET) == 0 && fread(dims, sizeof(int), 3, file) == 3 &&
+            fread(&nruns, sizeof(int64_t), 1, file) == 1 && dims[0] > 0 && dims[1] > 0 && dims[2] > 0)
+        {
+            // Payload, whose runs must be able to hold all voxels
+            start = ftell(file);
+            fseek(file, 0, SEEK_END);
+            end = ftell(file);
+            fseek(file, start, SEEK_SET);
+            n = end > start ? (size_t)(end - start) : 0;
+            if ((size_t)dims[0] * dims[1] <= SIZE_MAX / dims[2])
+                size = (size_t)dims[0] * dims[1] * dims[2];
+            if (size > 0 && size <= max_runs_length(n, nruns))
+            {
+                payload = (unsigned char *)malloc(n + 1);
+                *grid = (signed char *)huge_alloc(size * sizeof(signed char));
+            }
+
+            if (payload != NULL && *grid != NULL && fread(payload, 1, n, file) == n)
+            {
+                p = v = 0;
+                for (r = 0; r < nruns && p < n; r++)
+                {
+                    label = (signed char)payload[p++];
+
+                    length = 0;
+                    shift = 0;
+                    while (p < n && (payload[p] & 0x80) && shift < 56)
+                    {
+                        length |= (size_t)(payload[p++] & 0x7F) << shift;
+                        shift += 7;
+                    }
+                    if (p == n || (payload[p] & 0x80) || length + ((size_t)payload[p] << shift) > size - v)
+                        break;
+                    length |= (size_t)payload[p++] << shift;
+                    memset(*grid + v, label, length);
+                    v += length;
+                }
+                if (r == nruns && v == size)
+                    status = 0;
+            }
+            free(payload);
+        }
+        fclose(file);
+    }
 
-    if (*head == NULL || (*head)->pos >= res_new->pos)
+    if (status != 0)
     {
-        res_new->next = *head;
-        *head = res_new;
+        // Empty grid, never NULL so it can be handed over
+        free(*grid);
+        *grid = (signed char *)malloc(1);
+        dims[0] = dims[1] = dims[2] = 0;
     }
-    else
+    *dx = dims[0];
+    *dy = dims[1];
+    *dz = dims[2];
+
+    return status;
+}
+
+/* Solvent-exposed residues detection */
+
+/*
+ * Function: search_interface
+ * --------------------------
+ * 
+ * Search surface points around atoms, visited in Morton order of their
+ * centers
+ * 
+ * projected: atoms in 3D grid coordinates
+ * exposed: atoms to search (1) or skip (0), on output interface atoms (1)
+ * grid: cavities 3D grid
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * nthreads: number of threads for OpenMP
+ * 
+ */
+void search_interface(projection *projected, signed char *exposed, signed char *grid, int nx, int ny, int nz, double step, double probe, int nthreads)
+{
+    int i, j, n, imin, imax, jmin, jmax, kmin, kmax, atom, found, natoms = projected->natoms;
+    int *order = projected->order;
+    double x, y, z, d2, w, H, H2, *centers = projected->centers;
+
+    // Set number of processes in OpenMP
+    omp_set_num_threads(nthreads);
+    omp_set_nested(1);
+
+#pragma omp parallel default(none), shared(grid, nx, ny, nz, natoms, step, probe, centers, order, exposed), private(n, atom, i, j, imin, imax, jmin, jmax, kmin, kmax, found, x, y, z, d2, w, H, H2)
     {
-        current = *head;
-        while (current->next != NULL && current->next->pos < res_new->pos)
+#pragma omp for schedule(dynamic)
+        for (n = 0; n < natoms; n++)
         {
-            current = current->next;
+            atom = order[n];
+            if (!exposed[atom])
+                continue;
+
+            // Create a radius (H) for space occupied by probe and atom
+            x = centers[atom * 4];
+            y = centers[1 + (atom * 4)];
+            z = centers[2 + (atom * 4)];
+            H = grid_radius(centers[3 + (atom * 4)], step, probe);
+            H2 = H * H;
+
+            // Clip radius from atom center to 3D grid, without its first plane
+            imin = floor(x - H) > 1 ? floor(x - H) : 1;
+            imax = ceil(x + H) < nx - 1 ? ceil(x + H) : nx - 1;
+            jmin = floor(y - H) > 1 ? floor(y - H) : 1;
+            jmax = ceil(y + H) < ny - 1 ? ceil(y + H) : ny - 1;
+
+            // Loop around rows from atom center until a surface point is found
+            found = 0;
+            for (i = imin; i <= imax && !found; i++)
+                for (j = jmin; j <= jmax && !found; j++)
+                {
+                    d2 = (i - x) * (i - x) + (j - y) * (j - y);
+                    if (d2 > H2)
+                        continue;
+
+                    // Span of row inside radius, bounded one voxel past the sphere
+                    w = sqrt(H2 - d2);
+                    kmin = ceil(z - w) - 1;
+                    kmax = floor(z + w) + 1;
+                    while (kmin <= kmax && d2 + (kmin - z) * (kmin - z) > H2)
+                        kmin++;
+                    while (kmax >= kmin && d2 + (kmax - z) * (kmax - z) > H2)
+                        kmax--;
+                    kmin = kmin > 1 ? kmin : 1;
+                    kmax = kmax < nz - 1 ? kmax : nz - 1;
+
+                    if (kmin <= kmax)
+                        found = memchr(grid + kmin + (size_t)nz * (j + (size_t)ny * i), 1, kmax - kmin + 1) != NULL;
+                }
+            exposed[atom] = found;
         }
-        res_new->next = current->next;
-        current->next = res_new;
     }
 }
 
+/*
+ * Function: collect_interface
+ * ---------------------------
+ * 
+ * Pass interface atoms to an array allocated here, never empty so it can be
+ * handed over to the caller, who releases it with free
+ * 
+ * indexes: ascending indexes of interface atoms (output)
+ * nindexes: number of interface atoms (output)
+ * exposed: interface atoms (1)
+ * natoms: number of atoms
+ * 
+ */
+void collect_interface(int **indexes, int *nindexes, signed char *exposed, int natoms)
+{
+    int atom, count = 0;
+
+    for (atom = 0; atom < natoms; atom++)
+        count += exposed[atom];
+    *indexes = (int *)malloc((count + 1) * sizeof(int));
+    for (atom = 0, count = 0; atom < natoms; atom++)
+        if (exposed[atom])
+            (*indexes)[count++] = atom;
+    *nindexes = count;
+}
+
 /*
  * Function: _interface
  * --------------------
  * 
- * Retrieve interface residues from solvent-exposed surface
+ * Retrieve interface atoms from solvent-exposed surface into an array
+ * allocated here and handed over to the caller, who releases it with free
  * 
+ * indexes: ascending indexes of interface atoms (output)
+ * nindexes: number of interface atoms (output)
  * grid: cavities 3D grid
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
- * pdb: 1D-array of residues information (resnum_chain)
  * atoms: xyz coordinates and radii of input pdb
  * natoms: number of atoms
  * xyzr: number of data per atom (4: xyzr)
@@ -664,78 +3442,176 @@ void insert(res **head, res *res_new)
  * nthreads: number of threads for OpenMP
  * verbose: print information to stdout
  * 
- * returns: array of strings with interface residues
  */
-char
-    **
-    _interface(int *grid, int nx, int ny, int nz, char **pdb, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads, int verbose)
+void _interface(int **indexes, int *nindexes, signed char *grid, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads, int verbose)
 {
-    int i, j, k, atom, count = 0, old_atom = -1;
-    double x, y, z, xaux, yaux, zaux, distance, H;
-    char **residues;
+    projection projected;
+    signed char *exposed;
 
     if (verbose)
         fprintf(stdout, "> Retrieving interface residues\n");
 
-    // Allocate memory for reslist structure
-    res *reslist, *new_res;
+    iprojection(&projected);
+    project_atoms(&projected, atoms, natoms, reference, sincos, step, nthreads);
 
-    // Initialize linked list
-    reslist = NULL;
+    // Search every atom
+    exposed = (signed char *)malloc(natoms * sizeof(signed char));
+    memset(exposed, 1, natoms * sizeof(signed char));
+    search_interface(&projected, exposed, grid, nx, ny, nz, step, probe, nthreads);
+    collect_interface(indexes, nindexes, exposed, natoms);
 
-    // Iterate through the list of atoms
-    for (atom = 0; atom < natoms; atom++)
-    {
-        // Convert atom coordinates in 3D grid coordinates
-        x = (atoms[atom * 4] - reference[0]) / step;
-        y = (atoms[1 + (atom * 4)] - reference[1]) / step;
-        z = (atoms[2 + (atom * 4)] - reference[2]) / step;
+    free(exposed);
+    free_projection(&projected);
+}
 
-        xaux = x * sincos[3] + z * sincos[2];
-        yaux = y;
-        zaux = (-x) * sincos[2] + z * sincos[3];
+/*
+ * Function: _workspace_interface
+ * ------------------------------
+ * 
+ * Retrieve interface atoms from solvent-exposed surface into an array
+ * allocated here and handed over to the caller, who releases it with free.
+ * Atoms are taken from the last surface definition of the workspace, so
+ * they are not converted in 3D grid coordinates again
+ * 
+ * indexes: ascending indexes of interface atoms (output)
+ * nindexes: number of interface atoms (output)
+ * ws: workspace
+ * grid: cavities 3D grid
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * selection: indexes of atoms to search
+ * nselection: number of atoms to search
+ * step: 3D grid spacing (A)
+ * probe: Probe size (A)
+ * nthreads: number of threads for OpenMP
+ * verbose: print information to stdout
+ * 
+ */
+void _workspace_interface(int **indexes, int *nindexes, workspace *ws, signed char *grid, int nx, int ny, int nz, int *selection, int nselection, double step, double probe, int nthreads, int verbose)
+{
+    int n, natoms = ws->projected.natoms;
+    signed char *exposed;
 
-        x = xaux;
-        y = yaux * sincos[1] - zaux * sincos[0];
-        z = yaux * sincos[0] + zaux * sincos[1];
+    if (verbose)
+        fprintf(stdout, "> Retrieving interface residues\n");
 
-        // Create a radius (H) for space occupied by probe and atom
-        H = (probe + atoms[3 + (atom * 4)]) / step;
+    // Search selected atoms
+    exposed = (signed char *)calloc(natoms + 1, sizeof(signed char));
+    for (n = 0; n < nselection; n++)
+        if (selection[n] >= 0 && selection[n] < natoms)
+            exposed[selection[n]] = 1;
+    search_interface(&ws->projected, exposed, grid, nx, ny, nz, step, probe, nthreads);
+    collect_interface(indexes, nindexes, exposed, natoms);
 
-        // Loop around radius from atom center
-        for (i = floor(x - H); i <= ceil(x + H); i++)
-            for (j = floor(y - H); j <= ceil(y + H); j++)
-                for (k = floor(z - H); k <= ceil(z + H); k++)
-                {
-                    if (i < nx && i > 0 && j < ny && j > 0 && k < nz && k > 0)
-                        if (grid[k + nz * (j + (ny * i))] == 1)
-                        {
-                            distance = sqrt(pow(i - x, 2) + pow(j - y, 2) + pow(k - z, 2));
-                            if (distance <= H)
-                            {
-                                if (old_atom != atom)
-                                {
-                                    new_res = create(atom);
-                                    insert(&reslist, new_res);
-                                    count++;
-                                }
-                                old_atom = atom;
-                            }
-                        }
-                }
-    }
+    free(exposed);
+}
+
+/* Multi-probe sweep */
+
+/*
+ * Function: _sweep
+ * ----------------
+ * 
+ * Define solvent-exposed surfaces and interface atoms of a target
+ * biomolecule for several probes sharing one 3D grid. Atoms are inserted
+ * once as a distance field up to the largest probe, which is thresholded
+ * for each probe. Surfaces and interface atoms are allocated here and
+ * handed over to the caller, who releases them with free
+ * 
+ * grids: surface 3D grid of each probe (output)
+ * dp: number of probes (output)
+ * dx: x grid units (output)
+ * dy: y grid units (output)
+ * dz: z grid units (output)
+ * indexes: ascending indexes of interface atoms of each probe, one probe
+ *          after another (output)
+ * nindexes: number of interface atoms of all probes (output)
+ * offsets: first interface atom of each probe and total number of
+ *          interface atoms (output)
+ * noffsets: number of probes plus one (output)
+ * nx: x grid units
+ * ny: y grid units
+ * nz: z grid units
+ * atoms: xyz coordinates and radii of input pdb
+ * natoms: number of atoms
+ * xyzr: number of data per atom (4: xyzr)
+ * reference: xyz coordinates of 3D grid origin
+ * ndims: number of coordinates (3: xyz)
+ * sincos: sin and cos of 3D grid angles
+ * nvalues: number of sin and cos (sina, cosa, sinb, cosb)
+ * step: 3D grid spacing (A)
+ * probes: Probe sizes (A)
+ * nprobes: number of probes
+ * selection: indexes of atoms to search for interface atoms
+ * nselection: number of atoms to search for interface atoms
+ * is_ses: surface mode (1: SES or 0: SAS)
+ * nthreads: number of threads for OpenMP
+ * verbose: print extra information to standard output
+ * 
+ */
+void _sweep(signed char **grids, int *dp, int *dx, int *dy, int *dz, int **indexes, int *nindexes, int **offsets, int *noffsets, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double *probes, int nprobes, int *selection, int nselection, int is_ses, int nthreads, int verbose)
+{
+    int p, n, atom, count = 0;
+    size_t size = (size_t)nx * ny * nz;
+    double cutoff = 0.0;
+    float *field;
+    signed char *exposed;
+    workspace ws;
+
+    iworkspace(&ws, nx, ny, nz, FIRST_TOUCH, nthreads);
+    project_atoms(&ws.projected, atoms, natoms, reference, sincos, step, nthreads);
+
+    // Insert atoms once, up to the largest probe
+    for (p = 0; p < nprobes; p++)
+        cutoff = probes[p] > cutoff ? probes[p] : cutoff;
+    if (verbose)
+        fprintf(stdout, "> Defining distance field\n");
+    field = (float *)huge_alloc(size * sizeof(float));
+    distance_field(field, nx, ny, nz, &ws.projected, step, cutoff, nthreads);
 
-    // Pass res information to char **
-    residues = calloc(count + 1, sizeof(char *));
-    new_res = reslist;
-    j = 0;
-    while (new_res != NULL)
+    // Allocate outputs with the grid allocator, ownership passes to the caller
+    *grids = (signed char *)huge_alloc((nprobes > 0 ? nprobes : 1) * size * sizeof(signed char));
+    *offsets = (int *)malloc((nprobes + 1) * sizeof(int));
+    exposed = (signed char *)malloc(((size_t)nprobes * natoms + 1) * sizeof(signed char));
+
+    (*offsets)[0] = 0;
+    for (p = 0; p < nprobes; p++)
     {
-        residues[j++] = pdb[new_res->pos];
-        new_res = new_res->next;
+        if (verbose)
+            fprintf(stdout, "> Probe: %.2lf A\n", probes[p]);
+        resize_grid(&ws.grid, nx, ny, nz, nthreads);
+        threshold_field(&ws.grid, field, probes[p], nthreads);
+        shape_surface(&ws, step, probes[p], is_ses, 0, nthreads, verbose);
+        export_grid(&ws.grid, *grids + p * size, 0, nthreads);
+
+        // Search selected atoms, with the probe addition of interface
+        memset(exposed + (size_t)p * natoms, 0, natoms * sizeof(signed char));
+        for (n = 0; n < nselection; n++)
+            if (selection[n] >= 0 && selection[n] < natoms)
+                exposed[(size_t)p * natoms + selection[n]] = 1;
+        search_interface(&ws.projected, exposed + (size_t)p * natoms, *grids + p * size, nx, ny, nz, step, probes[p] + step / 2, nthreads);
+        for (atom = 0; atom < natoms; atom++)
+            count += exposed[(size_t)p * natoms + atom];
+        (*offsets)[p + 1] = count;
     }
-    free(reslist);
-    residues[j] = NULL;
 
-    return residues;
+    // Pass interface atoms of all probes to indexes, never empty so it can
+    // be handed over
+    *indexes = (int *)malloc((count + 1) * sizeof(int));
+    for (p = 0, n = 0; p < nprobes; p++)
+        for (atom = 0; atom < natoms; atom++)
+            if (exposed[(size_t)p * natoms + atom])
+                (*indexes)[n++] = atom;
+
+    free(field);
+    free(exposed);
+    free_workspace(&ws);
+
+    *dp = nprobes;
+    *dx = nx;
+    *dy = ny;
+    *dz = nz;
+    *nindexes = count;
+    *noffsets = nprobes + 1;
 }
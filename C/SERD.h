@@ -1,35 +1,145 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sparse brick-map grid */
+typedef struct brickmap
+{
+    int nx;
+    int ny;
+    int nz;
+    int bx;
+    int by;
+    int bz;
+    int nbricks;
+    signed char *uniform;
+    int *slot;
+    signed char **chunks;
+    int nslots;
+    int pool;
+    int fallback;
+    int capacity;
+    int nchunks;
+    int placement;
+} brickmap;
+signed char *allocate_brick(brickmap *grid, int b);
+uint64_t morton_key(int bi, int bj, int bk);
+typedef struct ranked
+{
+    uint64_t key;
+    int slot;
+} ranked;
+int compare_ranked(const void *a, const void *b);
+void order_bricks(brickmap *grid, int nthreads);
+void collapse_bricks(brickmap *grid, int nthreads);
+void export_grid(brickmap *grid, signed char *dense, int release, int nthreads);
+int encode_row(brickmap *grid, int i, int j, signed char *runs, int *lengths);
+int encode_grid(brickmap *grid, int **offsets, signed char **runs, int **lengths, int nthreads);
+
 /* Grid initialization */
-void igrid(int *grid, int size);
+void *huge_alloc(size_t length);
+void place_memory(void *memory, size_t length, int placement);
+void resize_grid(brickmap *grid, int nx, int ny, int nz, int nthreads);
+void igrid(brickmap *grid, int nx, int ny, int nz, int placement, int nthreads);
+void map_grid(brickmap *grid, char *scratch);
+signed char *allocate_chunk(brickmap *grid, int c);
+void free_grid(brickmap *grid);
+
+/* SIMD kernels */
+void select_kernels(void);
+
+/* Bit-packed occupancy bricks */
+typedef struct bitbricks
+{
+    int *slot;
+    uint64_t *words;
+    int capacity;
+    size_t nwords;
+} bitbricks;
+void ibits(bitbricks *bits);
+void pack_bricks(brickmap *grid, signed char label, bitbricks *bits, int nthreads);
+void free_bits(bitbricks *bits);
+int dilate_brick(brickmap *grid, bitbricks *bits, int bi, int bj, int bk, uint64_t *dilated);
+void filter_brick(brickmap *grid, bitbricks *bits, int b, signed char next, signed char apart);
 
 /* Grid filling */
-void fill(int *grid, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads);
+void sort_atoms(double *centers, int natoms, int *order);
+typedef struct projection
+{
+    double *centers;
+    int *order;
+    int natoms;
+    int capacity;
+} projection;
+void iprojection(projection *projected);
+void project_atoms(projection *projected, double *atoms, int natoms, double *reference, double *sincos, double step, int nthreads);
+void free_projection(projection *projected);
+typedef struct stencil
+{
+    double H;
+    int extent;
+    int width;
+    short *rows;
+} stencil;
+void build_stencil(stencil *st, double H);
+void fill_atom(brickmap *grid, stencil *st, int64_t x, int64_t y, int64_t z, int64_t H, int first, int last);
+int *bin_atoms(int *first, int *lower, int *upper, int *order, int natoms, int nslabs);
+void fill(brickmap *grid, projection *projected, double step, double probe, int nthreads);
+
+/* Distance field */
+void distance_atom(float *field, int ny, int nz, double x, double y, double z, double radius, double band, double step, int first, int last);
+void distance_field(float *field, int nx, int ny, int nz, projection *projected, double step, double cutoff, int nthreads);
+void threshold_field(brickmap *grid, float *field, double probe, int nthreads);
+void _distance(float **field, int *dx, int *dy, int *dz, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double cutoff, int nthreads, int verbose);
 
 /* Biomolecular surface representation */
-int check_protein_neighbours(int *grid, int nx, int ny, int nz, int i, int j, int k);
-void ses(int *grid, int nx, int ny, int nz, double step, double probe, int nthreads);
+void ses(brickmap *grid, bitbricks *protein, double step, double probe, int nthreads);
 
 /* Surface points detection */
-int define_surface_points(int *grid, int nx, int ny, int nz, int i, int j, int k);
-void filter_surface(int *grid, int nx, int ny, int nz, int nthreads);
+void filter_surface(brickmap *grid, bitbricks *biomolecule, int nthreads);
 
 /* Filter noise points */
-int remove_noise_points(int *grid, int nx, int ny, int nz, int i, int j, int k);
-void filter_noise_points(int *grid, int nx, int ny, int nz, int nthreads);
+void filter_noise_points(brickmap *grid, bitbricks *solvent, int nthreads);
 
 /* Enclosed points removal - flood and fill algorithm */
-int check_unclustered_neighbours(int *grid, int nx, int ny, int nz, int i, int j, int k);
-void flood_and_fill(int *grid, int nx, int ny, int nz, int i, int j, int k, int tag);
-void filter_enclosed_regions(int *grid, int nx, int ny, int nz, double step, int nthreads);
+typedef struct cluster
+{
+    signed char **voxels;
+    int size;
+    int capacity;
+} cluster;
+void append(cluster *members, signed char *voxel);
+int check_unclustered_neighbours(brickmap *grid, int i, int j, int k);
+void flood_and_fill(brickmap *grid, int i, int j, int k, signed char tag, cluster *members);
+void filter_enclosed_regions(brickmap *grid, cluster *members, double step, int nthreads);
 
 /* Solvent-exposed surface detection */
-void _surface(int *grid, int size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int nthreads, int verbose);
+typedef struct workspace
+{
+    brickmap grid;
+    bitbricks bits;
+    cluster members;
+    projection projected;
+} workspace;
+void iworkspace(workspace *ws, int nx, int ny, int nz, int placement, int nthreads);
+void free_workspace(workspace *ws);
+workspace *_create_workspace(void);
+void _destroy_workspace(workspace *ws);
+void shape_surface(workspace *ws, double step, double probe, int is_ses, int morton, int nthreads, int verbose);
+void define_surface(workspace *ws, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int morton, int nthreads, int verbose);
+void _surface(signed char **grid, int *dx, int *dy, int *dz, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose);
+int _mapped_surface(signed char *mapped, size_t size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, char *scratch, int nthreads, int verbose);
+int _workspace_surface(workspace *ws, signed char *buffer, size_t size, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose);
+void _rle_surface(int **offsets, int *noffsets, signed char **runs, int *nruns, int **lengths, int *nlengths, workspace *ws, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int is_ses, int placement, int morton, int nthreads, int verbose);
+
+/* Surface grid cache */
+int _save_surface(signed char *grid, int nx, int ny, int nz, double *vertices, int nvertices, int ncoords, double step, double probe, int representation, char *fn);
+int _load_surface(signed char **grid, int *dx, int *dy, int *dz, char *fn);
 
 /* Solvent-exposed residues detection */
-typedef struct node
-{
-    int pos;
-    struct node *next;
-} res;
-res *create(int pos);
-void insert(res **head, res *res_new);
-char **_interface(int *grid, int nx, int ny, int nz, char **pdb, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads, int verbose);
+void search_interface(projection *projected, signed char *exposed, signed char *grid, int nx, int ny, int nz, double step, double probe, int nthreads);
+void collect_interface(int **indexes, int *nindexes, signed char *exposed, int natoms);
+void _interface(int **indexes, int *nindexes, signed char *grid, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double probe, int nthreads, int verbose);
+void _workspace_interface(int **indexes, int *nindexes, workspace *ws, signed char *grid, int nx, int ny, int nz, int *selection, int nselection, double step, double probe, int nthreads, int verbose);
+
+/* Multi-probe sweep */
+void _sweep(signed char **grids, int *dp, int *dx, int *dy, int *dz, int **indexes, int *nindexes, int **offsets, int *noffsets, int nx, int ny, int nz, double *atoms, int natoms, int xyzr, double *reference, int ndims, double *sincos, int nvalues, double step, double *probes, int nprobes, int *selection, int nselection, int is_ses, int nthreads, int verbose);
@@ -1,6 +1,7 @@
 import os
 import pathlib
-from typing import Union, Optional, Literal, List, Dict
+import tempfile
+from typing import Union, Optional, Literal, List, Dict, Tuple
 import numpy
 import networkx
 from pyKVFinder import read_vdw, read_xyz
@@ -12,18 +13,40 @@ __all__ = [
     "read_xyz",
     "read_pdb",
     "get_vertices",
+    "Workspace",
+    "RLESurface",
     "_get_sincos",
     "_get_dimensions",
     "surface",
+    "distance",
     "interface",
     "detect",
+    "sweep",
     "save",
+    "save_surface",
+    "load_surface",
     "save_session",
     "r2g",
     "g2pdb",
 ]
 
 
+_REPRESENTATIONS = ["VDW", "SES", "SAS"]
+
+_CACHE_HEADER = numpy.dtype(
+    [
+        ("magic", "S4"),
+        ("version", "=i4"),
+        ("vertices", "=f8", (4, 3)),
+        ("step", "=f8"),
+        ("probe", "=f8"),
+        ("representation", "=i4"),
+        ("dims", "=i4", (3,)),
+        ("nruns", "=i8"),
+    ]
+)
+
+
 def _process_residues(residues: List[str]) -> List[List[str]]:
     """Process raw list of residues from _interface or _detect to a list of
     residue information (residue number, chain identifier and residue name).
@@ -134,6 +157,7 @@ def get_vertices(
     atomic: numpy.ndarray,
     probe: Union[float, int] = 1.4,
     step: Union[float, int] = 0.6,
+    crop: bool = False,
 ) -> numpy.ndarray:
     """Gets 3D grid vertices.
 
@@ -146,6 +170,9 @@ def get_vertices(
         Probe size (A), by default 4.0.
     step : Union[float, int], optional
         Grid spacing (A), by default 0.6.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus probe and a halo of one
+        grid unit, by default False. The cropped grid shares the grid points of the default grid.
 
     Returns
     -------
@@ -158,9 +185,186 @@ def get_vertices(
     # Get vertices
     vertices = gv(atomic, 2 * probe, 2 * step)
 
+    if crop:
+        # Get minimal box covering atoms plus probe
+        xyz = atomic[:, 4:7].astype(float)
+        radius = atomic[:, 7].astype(float).reshape(-1, 1)
+        lower = numpy.min(xyz - radius, axis=0) - probe
+        upper = numpy.max(xyz + radius, axis=0) + probe
+
+        # Add a halo of one grid unit, keeping origin on default grid points
+        P1 = vertices[0] + numpy.floor((lower - step - vertices[0]) / step) * step
+
+        # Keep two grid units past upper limit, since boundary points are never
+        # clustered, plus half grid unit so _get_dimensions rounds down to them
+        xmax, ymax, zmax = P1 + (numpy.ceil((upper - P1) / step) + 1.5) * step
+        P2 = numpy.array([xmax, P1[1], P1[2]])
+        P3 = numpy.array([P1[0], ymax, P1[2]])
+        P4 = numpy.array([P1[0], P1[1], zmax])
+        vertices = numpy.array([P1, P2, P3, P4])
+
     return vertices
 
 
+class Workspace:
+    """Reusable buffers for surface definitions of similar-sized biomolecules.
+
+    A workspace owns the surface 3D grid and the working buffers of the C
+    kernels. They only grow, so consecutive calls of `surface` or `detect`
+    with the same workspace skip allocation and page faulting once the
+    largest grid was seen. It also keeps the atoms of the last surface
+    converted in 3D grid coordinates, that `interface` reuses for the same
+    atoms and grid.
+
+    Note
+    ----
+    The surface returned by `surface` with a workspace is a view of the
+    workspace buffer and it is overwritten by the next call with the same
+    workspace. Copy it to keep it.
+    """
+
+    def __init__(self):
+        from _SERD import _create_workspace, _destroy_workspace
+
+        self._workspace = _create_workspace()
+        self._destroy = _destroy_workspace
+        self._buffer = numpy.empty(0, dtype=numpy.int8)
+        self._projection = None
+
+    def __del__(self):
+        if getattr(self, "_workspace", None) is not None:
+            self._destroy(self._workspace)
+            self._workspace = None
+
+    def _get_buffer(self, size: int) -> numpy.ndarray:
+        """Gets surface 3D grid buffer of a given number of voxels.
+
+        Parameters
+        ----------
+        size : int
+            Number of voxels.
+
+        Returns
+        -------
+        buffer : numpy.ndarray
+            A view of the first `size` voxels of the workspace buffer.
+        """
+        if self._buffer.size < size:
+            self._buffer = numpy.empty(size, dtype=numpy.int8)
+        return self._buffer[:size]
+
+    def _set_projection(
+        self, xyzr: numpy.ndarray, vertices: numpy.ndarray, step: float
+    ) -> None:
+        """Records the atoms and 3D grid of the atoms kept by the C workspace.
+
+        Parameters
+        ----------
+        xyzr : numpy.ndarray
+            Coordinates and radii of atoms of the last surface.
+        vertices : numpy.ndarray
+            Vertices of the 3D grid of the last surface.
+        step : float
+            Grid spacing (A) of the last surface.
+        """
+        self._projection = (xyzr, vertices.copy(), step)
+
+    def _has_projection(
+        self, xyzr: numpy.ndarray, vertices: numpy.ndarray, step: float
+    ) -> bool:
+        """Checks whether the C workspace keeps these atoms in this 3D grid.
+
+        Parameters
+        ----------
+        xyzr : numpy.ndarray
+            Coordinates and radii of atoms.
+        vertices : numpy.ndarray
+            Vertices of the 3D grid.
+        step : float
+            Grid spacing (A).
+
+        Returns
+        -------
+        bool
+            Whether the atoms of the last surface can be reused.
+        """
+        if self._projection is None:
+            return False
+        cached, corners, spacing = self._projection
+        return (
+            spacing == step
+            and cached.shape == xyzr.shape
+            and numpy.array_equal(corners, vertices)
+            and numpy.array_equal(cached, xyzr)
+        )
+
+
+class RLESurface:
+    """Run-length encoded surface 3D grid.
+
+    Labels are stored as runs along z of each (x, y) row. Runs never cross
+    rows, so row (i, j) holds runs `offsets[r]` to `offsets[r + 1] - 1`, with
+    `r = i * ny + j`.
+
+    Parameters
+    ----------
+    shape : tuple
+        Shape of the 3D grid (nx, ny, nz).
+    offsets : numpy.ndarray
+        First run of each row and total number of runs (nx * ny + 1).
+    runs : numpy.ndarray
+        Label of each run.
+    lengths : numpy.ndarray
+        Number of voxels of each run.
+    """
+
+    def __init__(
+        self,
+        shape: tuple,
+        offsets: numpy.ndarray,
+        runs: numpy.ndarray,
+        lengths: numpy.ndarray,
+    ):
+        self.shape = tuple(shape)
+        self.offsets = offsets
+        self.runs = runs
+        self.lengths = lengths
+
+    @property
+    def nbytes(self) -> int:
+        """Number of bytes of encoded 3D grid."""
+        return self.offsets.nbytes + self.runs.nbytes + self.lengths.nbytes
+
+    def row(self, i: int, j: int) -> numpy.ndarray:
+        """Decodes a z row of the 3D grid.
+
+        Parameters
+        ----------
+        i : int
+            x grid coordinate of row.
+        j : int
+            y grid coordinate of row.
+
+        Returns
+        -------
+        row : numpy.ndarray
+            Labels of row (surface[i, j, :]).
+        """
+        r = i * self.shape[1] + j
+        start, end = self.offsets[r], self.offsets[r + 1]
+        return numpy.repeat(self.runs[start:end], self.lengths[start:end])
+
+    def decode(self) -> numpy.ndarray:
+        """Decodes the 3D grid.
+
+        Returns
+        -------
+        surface : numpy.ndarray
+            Surface points in the 3D grid (surface[nx, ny, nz]).
+        """
+        return numpy.repeat(self.runs, self.lengths).reshape(self.shape)
+
+
 def surface(
     atomic: numpy.ndarray,
     surface_representation: Literal["VDW", "SES", "SAS"] = "SES",
@@ -168,7 +372,13 @@ def surface(
     probe: Union[float, int] = 1.4,
     nthreads: Optional[int] = None,
     verbose: bool = False,
-) -> numpy.ndarray:
+    crop: bool = False,
+    memmap: Optional[Union[bool, str, pathlib.Path]] = None,
+    workspace: Optional[Workspace] = None,
+    placement: Literal["first-touch", "interleave"] = "first-touch",
+    morton: bool = False,
+    rle: bool = False,
+) -> Union[numpy.ndarray, RLESurface]:
     """Defines the solvent-exposed surface of a target biomolecule in a 3D grid.
 
     Parameters
@@ -188,12 +398,36 @@ def surface(
         `os.cpu_count() - 1`.
     verbose : bool, optional
         Print extra information to standard output, by default False.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus probe and a halo of one
+        grid unit, by default False. The same value must be used in surface and interface.
+    memmap : Optional[Union[bool, str, pathlib.Path]], optional
+        Back the 3D grid with memory-mapped files for structures that do not fit in RAM, by
+        default None. If True, the surface is an anonymous numpy.memmap and the working grid is
+        paged to the temporary directory. If a path, the surface is written to this file and the
+        working grid is paged to its directory. If None or False, the surface is kept in memory.
+    workspace : Optional[Workspace], optional
+        A workspace whose buffers are reused, by default None. If set, the surface is a view of
+        the workspace buffer that is overwritten by the next call with the same workspace.
+        Ignored when `memmap` is set.
+    placement : Literal["first-touch", "interleave"], optional
+        NUMA placement policy of the 3D grid memory, by default "first-touch". With first-touch,
+        memory is placed on the socket of the thread that initializes it, following the static
+        partitioning of the kernels. With interleave, memory is spread over all sockets.
+    morton : bool, optional
+        Whether to store the working grid in Morton (Z-order) order of its 8x8x8 bricks, by
+        default False. Bricks that are neighbours in space are then close in memory.
+    rle : bool, optional
+        Whether to return the 3D grid run-length encoded along z (SERD.RLESurface), by default
+        False. The encoding is produced directly from the working grid, without a dense copy.
+        Ignored when `memmap` is set.
 
     Returns
     -------
-    surface : numpy.ndarray
-        Surface points in the 3D grid (surface[nx, ny, nz]).
-        Surface array has integer labels in each positions, that are:
+    surface : Union[numpy.ndarray, RLESurface]
+        Surface points in the 3D grid (surface[nx, ny, nz]). A numpy.memmap when `memmap` is set
+        and a SERD.RLESurface when `rle` is set.
+        Surface array has narrow integer labels (numpy.int8) in each positions, that are:
 
             * -1: solvent points;
 
@@ -225,10 +459,22 @@ def surface(
         `nthreads` must be a positive integer.
     TypeError
         `verbose` must be a boolean.
+    TypeError
+        `crop` must be a boolean.
+    TypeError
+        `memmap` must be a boolean, a string or a pathlib.Path.
+    TypeError
+        `workspace` must be a SERD.Workspace.
+    TypeError
+        `placement` must be `first-touch` or `interleave`.
+    TypeError
+        `morton` must be a boolean.
+    TypeError
+        `rle` must be a boolean.
     ValueError
         `probe` must be a positive real number, when SES or SAS is set.
     """
-    from _SERD import _surface
+    from _SERD import _surface, _mapped_surface, _workspace_surface, _rle_surface
 
     # Check arguments types
     if type(atomic) not in [numpy.ndarray]:
@@ -256,10 +502,25 @@ def surface(
             raise ValueError("`nthreads` must be a positive integer.")
     if type(verbose) not in [bool]:
         raise TypeError("`verbose` must be a boolean.")
+    if type(crop) not in [bool]:
+        raise TypeError("`crop` must be a boolean.")
+    if memmap is not None:
+        if type(memmap) not in [bool, str] and not isinstance(memmap, pathlib.Path):
+            raise TypeError("`memmap` must be a boolean, a string or a pathlib.Path.")
+    if workspace is not None:
+        if type(workspace) not in [Workspace]:
+            raise TypeError("`workspace` must be a SERD.Workspace.")
+    if placement not in ["first-touch", "interleave"]:
+        raise TypeError("`placement` must be `first-touch` or `interleave`.")
+    if type(morton) not in [bool]:
+        raise TypeError("`morton` must be a boolean.")
+    if type(rle) not in [bool]:
+        raise TypeError("`rle` must be a boolean.")
 
     # Convert types
     step = float(step) if type(step) is int else step
     probe = float(probe) if type(probe) is int else probe
+    placement = 1 if placement == "interleave" else 0
 
     # If surface representation is the van der Waals surface, the probe must be 0.0
     if surface_representation == "VDW":
@@ -282,7 +543,7 @@ def surface(
             surface_representation = False
 
     # Get vertices
-    vertices = get_vertices(atomic, probe, step)
+    vertices = get_vertices(atomic, probe, step, crop)
 
     # Get sincos
     sincos = _get_sincos(vertices)
@@ -297,8 +558,208 @@ def surface(
     xyzr = atomic[:, 4:].astype(numpy.float64)
 
     # Identify solvent-exposed surface
-    surface = _surface(
-        size,
+    if (memmap is None or memmap is False) and rle:
+        offsets, runs, lengths = _rle_surface(
+            workspace._workspace if workspace is not None else None,
+            nx,
+            ny,
+            nz,
+            xyzr,
+            vertices[0],
+            sincos,
+            step,
+            probe,
+            surface_representation,
+            placement,
+            morton,
+            nthreads,
+            verbose,
+        )
+        surface = RLESurface((nx, ny, nz), offsets, runs, lengths)
+        if workspace is not None:
+            workspace._set_projection(xyzr, vertices, step)
+    elif (memmap is None or memmap is False) and workspace is not None:
+        buffer = workspace._get_buffer(size)
+        status = _workspace_surface(
+            workspace._workspace,
+            buffer,
+            nx,
+            ny,
+            nz,
+            xyzr,
+            vertices[0],
+            sincos,
+            step,
+            probe,
+            surface_representation,
+            placement,
+            morton,
+            nthreads,
+            verbose,
+        )
+        if status != 0:
+            raise ValueError("`surface` buffer does not match the 3D grid units.")
+        surface = buffer.reshape(nx, ny, nz)
+        workspace._set_projection(xyzr, vertices, step)
+    elif memmap is None or memmap is False:
+        surface = _surface(
+            nx,
+            ny,
+            nz,
+            xyzr,
+            vertices[0],
+            sincos,
+            step,
+            probe,
+            surface_representation,
+            placement,
+            morton,
+            nthreads,
+            verbose,
+        )
+    else:
+        # Create memory-mapped surface and scratch directory for working grid
+        if memmap is True:
+            mapped = numpy.memmap(
+                tempfile.TemporaryFile(), dtype=numpy.int8, mode="w+", shape=(size,)
+            )
+            scratch = tempfile.gettempdir()
+        else:
+            mapped = numpy.memmap(memmap, dtype=numpy.int8, mode="w+", shape=(size,))
+            scratch = os.path.dirname(os.path.abspath(memmap))
+        status = _mapped_surface(
+            mapped,
+            nx,
+            ny,
+            nz,
+            xyzr,
+            vertices[0],
+            sincos,
+            step,
+            probe,
+            surface_representation,
+            placement,
+            morton,
+            scratch,
+            nthreads,
+            verbose,
+        )
+        if status != 0:
+            raise ValueError("`surface` memory map does not match the 3D grid units.")
+        surface = mapped.reshape(nx, ny, nz)
+
+    return surface
+
+
+def distance(
+    atomic: numpy.ndarray,
+    step: Union[float, int] = 0.6,
+    cutoff: Union[float, int] = 2.0,
+    nthreads: Optional[int] = None,
+    verbose: bool = False,
+    crop: bool = False,
+) -> numpy.ndarray:
+    """Defines the signed distance from each point of a 3D grid to the van der Waals surface of
+    the nearest atom of a target biomolecule.
+
+    Parameters
+    ----------
+    atomic : numpy.ndarray
+        A numpy array with atomic data (residue number, chain, residue name, atom name, xyz coordinates
+        and radius) for each atom.
+    step : Union[float, int], optional
+        Grid spacing (A), by default 0.6.
+    cutoff : Union[float, int], optional
+        Largest distance (A) kept in the distance field, by default 2.0. The 3D grid is the grid of
+        `get_vertices` with `cutoff` as probe.
+    nthreads : Optional[int], optional
+        Number of threads, by default None. If None, the number of threads is
+        `os.cpu_count() - 1`.
+    verbose : bool, optional
+        Print extra information to standard output, by default False.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus cutoff and a halo of
+        one grid unit, by default False.
+
+    Returns
+    -------
+    field : numpy.ndarray
+        Distance field in the 3D grid (field[nx, ny, nz]) of single precision (numpy.float32).
+        Points inside atoms have negative distances and points farther than `cutoff` from every
+        atom are clamped to `cutoff`. For a probe up to `cutoff`, points with `field < probe`
+        are the biomolecule points of the SAS representation and points with `field < 0` are
+        the biomolecule points of the van der Waals representation.
+
+    Raises
+    ------
+    TypeError
+        `atomic` must be a numpy.ndarray.
+    ValueError
+        `atomic` has incorrect shape. It must be (n, 8).
+    TypeError
+        `step` must be a positive real number.
+    ValueError
+        `step` must be a positive real number.
+    TypeError
+        `cutoff` must be a non-negative real number.
+    ValueError
+        `cutoff` must be a non-negative real number.
+    TypeError
+        `nthreads` must be a positive integer.
+    ValueError
+        `nthreads` must be a positive integer.
+    TypeError
+        `verbose` must be a boolean.
+    TypeError
+        `crop` must be a boolean.
+    """
+    from _SERD import _distance
+
+    # Check arguments types
+    if type(atomic) not in [numpy.ndarray]:
+        raise TypeError("`atomic` must be a numpy.ndarray.")
+    elif len(atomic.shape) != 2:
+        raise ValueError("`atomic` has incorrect shape. It must be (n, 8).")
+    elif atomic.shape[1] != 8:
+        raise ValueError("`atomic` has incorrect shape. It must be (n, 8).")
+    if type(step) not in [float, int]:
+        raise TypeError("`step` must be a positive real number.")
+    elif step <= 0.0:
+        raise ValueError("`step` must be a positive real number.")
+    if type(cutoff) not in [float, int]:
+        raise TypeError("`cutoff` must be a non-negative real number.")
+    elif cutoff < 0.0:
+        raise ValueError("`cutoff` must be a non-negative real number.")
+    if nthreads is None:
+        nthreads = os.cpu_count() - 1
+    else:
+        if type(nthreads) not in [int]:
+            raise TypeError("`nthreads` must be a positive integer.")
+        elif nthreads <= 0:
+            raise ValueError("`nthreads` must be a positive integer.")
+    if type(verbose) not in [bool]:
+        raise TypeError("`verbose` must be a boolean.")
+    if type(crop) not in [bool]:
+        raise TypeError("`crop` must be a boolean.")
+
+    # Convert types
+    step = float(step) if type(step) is int else step
+    cutoff = float(cutoff) if type(cutoff) is int else cutoff
+
+    # Get vertices
+    vertices = get_vertices(atomic, cutoff, step, crop)
+
+    # Get sincos
+    sincos = _get_sincos(vertices)
+
+    # Get dimensions
+    nx, ny, nz = _get_dimensions(vertices, step)
+
+    # Extract xyzr from atomic
+    xyzr = atomic[:, 4:].astype(numpy.float64)
+
+    # Define distance field
+    field = _distance(
         nx,
         ny,
         nz,
@@ -306,23 +767,24 @@ def surface(
         vertices[0],
         sincos,
         step,
-        probe,
-        surface_representation,
+        cutoff,
         nthreads,
         verbose,
-    ).reshape(nx, ny, nz)
+    )
 
-    return surface
+    return field
 
 
 def interface(
-    surface: numpy.ndarray,
+    surface: Union[numpy.ndarray, RLESurface],
     atomic: numpy.ndarray,
     ignore_backbone: bool = True,
     step: Union[float, int] = 0.6,
     probe: Union[float, int] = 1.4,
     nthreads: Optional[int] = None,
     verbose: bool = False,
+    crop: bool = False,
+    workspace: Optional[Workspace] = None,
 ) -> List[List[str]]:
     """Identifies the solvent-exposed residues based on a target solvent-exposed surface
     and atomic information of a biomolecule (residue number, chain identifier, residue
@@ -330,8 +792,8 @@ def interface(
 
     Parameters
     ----------
-    surface : numpy.ndarray
-        Surface points in the 3D grid (surface[nx, ny, nz]).
+    surface : Union[numpy.ndarray, RLESurface]
+        Surface points in the 3D grid (surface[nx, ny, nz]). A SERD.RLESurface is decoded first.
         Surface array has integer labels in each positions, that are:
 
             * -1: solvent points;
@@ -355,6 +817,12 @@ def interface(
         `os.cpu_count() - 1`.
     verbose : bool, optional
         Print extra information to standard output, by default False.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus probe and a halo of one
+        grid unit, by default False. The same value must be used in surface and interface.
+    workspace : Optional[Workspace], optional
+        The workspace of the surface definition, by default None. If set and it holds the same
+        atoms and 3D grid, the atoms converted in 3D grid coordinates by `surface` are reused.
 
     Returns
     -------
@@ -385,11 +853,17 @@ def interface(
         `nthreads` must be a positive integer.
     TypeError
         `verbose` must be a boolean.
+    TypeError
+        `crop` must be a boolean.
+    TypeError
+        `workspace` must be a SERD.Workspace.
     """
-    from _SERD import _interface
+    from _SERD import _interface, _workspace_interface
 
     # Check arguments types
-    if type(surface) not in [numpy.ndarray]:
+    if type(surface) in [RLESurface]:
+        surface = surface.decode()
+    if type(surface) not in [numpy.ndarray, numpy.memmap]:
         raise TypeError("`surface` must be a numpy.ndarray.")
     elif len(surface.shape) != 3:
         raise ValueError("`surface` has the incorrect shape. It must be (nx, ny, nz).")
@@ -418,9 +892,18 @@ def interface(
             raise ValueError("`nthreads` must be a positive integer.")
     if type(verbose) not in [bool]:
         raise TypeError("`verbose` must be a boolean.")
+    if type(crop) not in [bool]:
+        raise TypeError("`crop` must be a boolean.")
+    if workspace is not None:
+        if type(workspace) not in [Workspace]:
+            raise TypeError("`workspace` must be a SERD.Workspace.")
+
+    # Convert surface to narrow labels
+    if surface.dtype != numpy.int8:
+        surface = surface.astype(numpy.int8)
 
     # Get vertices
-    vertices = get_vertices(atomic, probe, step)
+    vertices = get_vertices(atomic, probe, step, crop)
 
     # Get sincos
     sincos = _get_sincos(vertices)
@@ -433,39 +916,47 @@ def interface(
         ([[f"{atom[0]}_{atom[1]}_{atom[2]}", atom[3]] for atom in atomic[:, :4]])
     )
 
-    # Remove backbone from atominfo
+    # Select atoms, removing backbone
     if ignore_backbone:
-        mask = numpy.where(
+        selection = numpy.where(
             (atominfo[:, 1] != "C")
             & (atominfo[:, 1] != "CA")
             & (atominfo[:, 1] != "N")
             & (atominfo[:, 1] != "O")
-        )
-        atominfo = atominfo[
-            mask[0],
-        ]
-        xyzr = xyzr[
-            mask[0],
-        ]
+        )[0]
+    else:
+        selection = numpy.arange(atominfo.shape[0])
 
     # Prepare atominfo
-    atominfo = atominfo[:, 0].tolist()
-
-    # Detect solvent-exposed residues
-    residues = _interface(
-        surface,
-        atominfo,
-        xyzr,
-        vertices[0],
-        sincos,
-        step,
-        probe + step / 2,
-        nthreads,
-        verbose,
-    )
+    atominfo = atominfo[:, 0]
+
+    # Detect solvent-exposed atoms
+    if workspace is not None and workspace._has_projection(xyzr, vertices, step):
+        indexes = _workspace_interface(
+            workspace._workspace,
+            surface,
+            selection.astype(numpy.int32),
+            step,
+            probe + step / 2,
+            nthreads,
+            verbose,
+        )
+    else:
+        indexes = selection[
+            _interface(
+                surface,
+                xyzr[selection],
+                vertices[0],
+                sincos,
+                step,
+                probe + step / 2,
+                nthreads,
+                verbose,
+            )
+        ]
 
     # Process residues
-    residues = _process_residues(residues)
+    residues = _process_residues(atominfo[indexes].tolist())
 
     return residues
 
@@ -479,6 +970,11 @@ def detect(
     ignore_backbone: bool = True,
     nthreads: Optional[int] = None,
     verbose: bool = False,
+    crop: bool = False,
+    memmap: Optional[Union[bool, str, pathlib.Path]] = None,
+    workspace: Optional[Workspace] = None,
+    placement: Literal["first-touch", "interleave"] = "first-touch",
+    morton: bool = False,
 ):
     """Detect solvent-exposed residues of a target biomolecule.
 
@@ -503,6 +999,23 @@ def detect(
         `os.cpu_count() - 1`.
     verbose : bool, optional
         Print extra information to standard output, by default False.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus probe and a halo of one
+        grid unit, by default False.
+    memmap : Optional[Union[bool, str, pathlib.Path]], optional
+        Back the 3D grid with memory-mapped files for structures that do not fit in RAM, by
+        default None. If True, anonymous memory-mapped files are used. If a path, the surface
+        is written to this file.
+    workspace : Optional[Workspace], optional
+        A workspace whose buffers are reused across calls, by default None. The atoms converted in
+        3D grid coordinates for the surface are then reused to detect solvent-exposed residues.
+    placement : Literal["first-touch", "interleave"], optional
+        NUMA placement policy of the 3D grid memory, by default "first-touch". With first-touch,
+        memory is placed on the socket of the thread that initializes it, following the static
+        partitioning of the kernels. With interleave, memory is spread over all sockets.
+    morton : bool, optional
+        Whether to store the working grid in Morton (Z-order) order of its 8x8x8 bricks, by
+        default False. Bricks that are neighbours in space are then close in memory.
 
     Returns
     -------
@@ -531,6 +1044,16 @@ def detect(
         `nthreads` must be a positive integer.
     TypeError
         `verbose` must be a boolean.
+    TypeError
+        `crop` must be a boolean.
+    TypeError
+        `memmap` must be a boolean, a string or a pathlib.Path.
+    TypeError
+        `workspace` must be a SERD.Workspace.
+    TypeError
+        `placement` must be `first-touch` or `interleave`.
+    TypeError
+        `morton` must be a boolean.
     ValueError
         `probe` must be a positive real number, when SES or SAS is set.
     ValueError
@@ -567,6 +1090,18 @@ def detect(
             raise ValueError("`nthreads` must be a positive integer.")
     if type(verbose) not in [bool]:
         raise TypeError("`verbose` must be a boolean.")
+    if type(crop) not in [bool]:
+        raise TypeError("`crop` must be a boolean.")
+    if memmap is not None:
+        if type(memmap) not in [bool, str] and not isinstance(memmap, pathlib.Path):
+            raise TypeError("`memmap` must be a boolean, a string or a pathlib.Path.")
+    if workspace is not None:
+        if type(workspace) not in [Workspace]:
+            raise TypeError("`workspace` must be a SERD.Workspace.")
+    if placement not in ["first-touch", "interleave"]:
+        raise TypeError("`placement` must be `first-touch` or `interleave`.")
+    if type(morton) not in [bool]:
+        raise TypeError("`morton` must be a boolean.")
 
     # Read van der Waals radii dictionary
     vdw = read_vdw(vdw)
@@ -580,16 +1115,225 @@ def detect(
         raise ValueError("`target` must be .pdb or .xyz.")
 
     # Define solvent-exposed surface
-    solvsurf = surface(atomic, surface_representation, step, probe, nthreads, verbose)
+    solvsurf = surface(
+        atomic,
+        surface_representation,
+        step,
+        probe,
+        nthreads,
+        verbose,
+        crop,
+        memmap,
+        workspace,
+        placement,
+        morton,
+    )
 
     # Define solvent-exposed residues
     residues = interface(
-        solvsurf, atomic, ignore_backbone, step, probe, nthreads, verbose
+        solvsurf,
+        atomic,
+        ignore_backbone,
+        step,
+        probe,
+        nthreads,
+        verbose,
+        crop,
+        workspace,
     )
 
     return residues
 
 
+def sweep(
+    atomic: numpy.ndarray,
+    probes: Optional[Union[List[Union[float, int]], numpy.ndarray]] = None,
+    surface_representation: Literal["SES", "SAS"] = "SES",
+    step: Union[float, int] = 0.6,
+    ignore_backbone: bool = True,
+    nthreads: Optional[int] = None,
+    verbose: bool = False,
+    crop: bool = False,
+) -> Tuple[numpy.ndarray, List[List[List[str]]]]:
+    """Defines the solvent-exposed surfaces and solvent-exposed residues of a target biomolecule
+    for several probe sizes in one call.
+
+    Atoms are inserted once in a distance field up to the largest probe, which is thresholded for
+    each probe, so every probe shares the 3D grid of the largest probe.
+
+    Parameters
+    ----------
+    atomic : numpy.ndarray
+        A numpy array with atomic data (residue number, chain, residue name, atom name, xyz coordinates
+        and radius) for each atom.
+    probes : Optional[Union[List[Union[float, int]], numpy.ndarray]], optional
+        Probe sizes (A) to define SES and SAS representations, by default None. If None, the probe
+        sizes are 1.0 to 2.0 A with a 0.1 A increment.
+    surface_representation : Literal["SES", "SAS"], optional
+        Surface representation. Keywords options are SES (Solvent Excluded Surface) or SAS (Solvent
+        Accessible Surface), by default "SES".
+    step : Union[float, int], optional
+        Grid spacing (A), by default 0.6.
+    ignore_backbone : bool, optional
+        Whether to ignore backbone atoms (C, CA, N, O) when defining interface residues, by default True.
+    nthreads : Optional[int], optional
+        Number of threads, by default None. If None, the number of threads is
+        `os.cpu_count() - 1`.
+    verbose : bool, optional
+        Print extra information to standard output, by default False.
+    crop : bool, optional
+        Whether to crop the 3D grid to the minimal box covering atoms plus the largest probe and a
+        halo of one grid unit, by default False.
+
+    Returns
+    -------
+    surfaces : numpy.ndarray
+        Surface points in the 3D grid of each probe (surfaces[nprobes, nx, ny, nz]), with the
+        labels of `surface`.
+    residues : List[List[List[str]]]
+        A list of solvent-exposed residues of each probe.
+
+    Raises
+    ------
+    TypeError
+        `atomic` must be a numpy.ndarray.
+    ValueError
+        `atomic` has incorrect shape. It must be (n, 8).
+    TypeError
+        `probes` must be a list of positive real numbers.
+    ValueError
+        `probes` must be a list of positive real numbers.
+    TypeError
+        `surface_representation` must be a `SES` or `SAS`.
+    TypeError
+        `step` must be a positive real number.
+    ValueError
+        `step` must be a positive real number.
+    TypeError
+        `ignore_backbone` must be a boolean.
+    TypeError
+        `nthreads` must be a positive integer.
+    ValueError
+        `nthreads` must be a positive integer.
+    TypeError
+        `verbose` must be a boolean.
+    TypeError
+        `crop` must be a boolean.
+
+    Note
+    ----
+    Points within rounding of an atom boundary may be labeled differently than by `surface` with
+    the same probe.
+    """
+    from _SERD import _sweep
+
+    # Check arguments types
+    if type(atomic) not in [numpy.ndarray]:
+        raise TypeError("`atomic` must be a numpy.ndarray.")
+    elif len(atomic.shape) != 2:
+        raise ValueError("`atomic` has incorrect shape. It must be (n, 8).")
+    elif atomic.shape[1] != 8:
+        raise ValueError("`atomic` has incorrect shape. It must be (n, 8).")
+    if probes is None:
+        probes = [round(1.0 + 0.1 * i, 1) for i in range(11)]
+    if type(probes) not in [list, tuple, numpy.ndarray]:
+        raise TypeError("`probes` must be a list of positive real numbers.")
+    elif len(probes) == 0:
+        raise ValueError("`probes` must be a list of positive real numbers.")
+    for probe in probes:
+        if not isinstance(probe, (float, int, numpy.floating, numpy.integer)):
+            raise TypeError("`probes` must be a list of positive real numbers.")
+        elif probe <= 0.0:
+            raise ValueError("`probes` must be a list of positive real numbers.")
+    if surface_representation not in ["SES", "SAS"]:
+        raise TypeError("`surface_representation` must be a `SES` or `SAS`.")
+    if type(step) not in [float, int]:
+        raise TypeError("`step` must be a positive real number.")
+    elif step <= 0.0:
+        raise ValueError("`step` must be a positive real number.")
+    if type(ignore_backbone) not in [bool]:
+        raise TypeError("`ignore_backbone` must be a boolean.")
+    if nthreads is None:
+        nthreads = os.cpu_count() - 1
+    else:
+        if type(nthreads) not in [int]:
+            raise TypeError("`nthreads` must be a positive integer.")
+        elif nthreads <= 0:
+            raise ValueError("`nthreads` must be a positive integer.")
+    if type(verbose) not in [bool]:
+        raise TypeError("`verbose` must be a boolean.")
+    if type(crop) not in [bool]:
+        raise TypeError("`crop` must be a boolean.")
+
+    # Convert types
+    step = float(step) if type(step) is int else step
+    probes = numpy.asarray(probes, dtype=numpy.float64)
+
+    if surface_representation == "SES":
+        if verbose:
+            print("> Surface representation: Solvent Excluded Surface (SES).")
+        surface_representation = True
+    elif surface_representation == "SAS":
+        if verbose:
+            print("> Surface representation: Solvent Accessible Surface (SAS).")
+        surface_representation = False
+
+    # Get vertices, covering the largest probe
+    vertices = get_vertices(atomic, float(probes.max()), step, crop)
+
+    # Get sincos
+    sincos = _get_sincos(vertices)
+
+    # Get dimensions
+    nx, ny, nz = _get_dimensions(vertices, step)
+
+    # Extract xyzr from atomic
+    xyzr = atomic[:, 4:].astype(numpy.float64)
+
+    # Extract atominfo from atomic
+    atominfo = numpy.asarray(
+        ([[f"{atom[0]}_{atom[1]}_{atom[2]}", atom[3]] for atom in atomic[:, :4]])
+    )
+
+    # Select atoms, removing backbone
+    if ignore_backbone:
+        selection = numpy.where(
+            (atominfo[:, 1] != "C")
+            & (atominfo[:, 1] != "CA")
+            & (atominfo[:, 1] != "N")
+            & (atominfo[:, 1] != "O")
+        )[0]
+    else:
+        selection = numpy.arange(atominfo.shape[0])
+
+    # Prepare atominfo
+    atominfo = atominfo[:, 0]
+
+    # Define solvent-exposed surfaces and atoms of every probe
+    surfaces, indexes, offsets = _sweep(
+        nx,
+        ny,
+        nz,
+        xyzr,
+        vertices[0],
+        sincos,
+        step,
+        probes,
+        selection.astype(numpy.int32),
+        surface_representation,
+        nthreads,
+        verbose,
+    )
+
+    # Process residues of each probe
+    residues = [
+        _process_residues(atominfo[indexes[offsets[p] : offsets[p + 1]]].tolist())
+        for p in range(len(probes))
+    ]
+
+    return surfaces, residues
+
+
 def save(residues: List[List[str]], fn: Union[str, pathlib.Path] = "residues.pickle"):
     """Save list of solvent-exposed residues to binary pickle file.
 
@@ -606,6 +1350,171 @@ def save(residues: List[List[str]], fn: Union[str, pathlib.Path] = "residues.pic
         pickle.dump(residues, f)
 
 
+def save_surface(
+    surface: Union[numpy.ndarray, RLESurface],
+    vertices: numpy.ndarray,
+    surface_representation: Literal["VDW", "SES", "SAS"] = "SES",
+    step: Union[float, int] = 0.6,
+    probe: Union[float, int] = 1.4,
+    fn: Union[str, pathlib.Path] = "surface.serd",
+):
+    """Save solvent-exposed surface to a compressed binary cache file.
+
+    The file holds a fixed header (vertices, step, probe, surface
+    representation and grid units) followed by the run-length encoded labels
+    of the 3D grid.
+
+    Parameters
+    ----------
+    surface : Union[numpy.ndarray, RLESurface]
+        Solvent-exposed surface points in the 3D grid (surface[nx, ny, nz]).
+    vertices : numpy.ndarray
+        A numpy.ndarray with xyz vertices coordinates
+        (origin, X-axis, Y-axis, Z-axis).
+    surface_representation : Literal["VDW", "SES", "SAS"], optional
+        Surface representation of `surface`, by default "SES".
+    step : Union[float, int], optional
+        Grid spacing (A) of `surface`, by default 0.6.
+    probe : Union[float, int], optional
+        Probe size (A) of `surface`, by default 1.4.
+    fn : Union[str, pathlib.Path], optional
+        A path to cache file, by default "surface.serd".
+
+    Raises
+    ------
+    TypeError
+        `surface` must be a numpy.ndarray.
+    ValueError
+        `surface` has the incorrect shape. It must be (nx, ny, nz).
+    TypeError
+        `vertices` must be a numpy.ndarray.
+    ValueError
+        `vertices` has incorrect shape. It must be (4, 3).
+    TypeError
+        `surface_representation` must be a `VDW`, `SES` or `SAS`.
+    TypeError
+        `step` must be a positive real number.
+    ValueError
+        `step` must be a positive real number.
+    TypeError
+        `probe` must be a non-negative real number.
+    ValueError
+        `probe` must be a non-negative real number.
+    TypeError
+        `fn` must be a string or a pathlib.Path.
+    OSError
+        Could not write surface cache file.
+    """
+    from _SERD import _save_surface
+
+    # Check arguments types
+    if type(surface) in [RLESurface]:
+        surface = surface.decode()
+    if type(surface) not in [numpy.ndarray, numpy.memmap]:
+        raise TypeError("`surface` must be a numpy.ndarray.")
+    elif len(surface.shape) != 3:
+        raise ValueError("`surface` has the incorrect shape. It must be (nx, ny, nz).")
+    if type(vertices) not in [numpy.ndarray]:
+        raise TypeError("`vertices` must be a numpy.ndarray.")
+    elif vertices.shape != (4, 3):
+        raise ValueError("`vertices` has incorrect shape. It must be (4, 3).")
+    if surface_representation not in _REPRESENTATIONS:
+        raise TypeError("`surface_representation` must be a `VDW`, `SES` or `SAS`.")
+    if type(step) not in [float, int]:
+        raise TypeError("`step` must be a positive real number.")
+    elif step <= 0.0:
+        raise ValueError("`step` must be a positive real number.")
+    if type(probe) not in [float, int]:
+        raise TypeError("`probe` must be a non-negative real number.")
+    elif probe < 0.0:
+        raise ValueError("`probe` must be a non-negative real number.")
+    if type(fn) not in [str, pathlib.Path]:
+        raise TypeError("`fn` must be a string or a pathlib.Path.")
+
+    # Write cache file
+    status = _save_surface(
+        numpy.ascontiguousarray(surface, dtype=numpy.int8),
+        vertices.astype(numpy.float64),
+        float(step),
+        float(probe),
+        _REPRESENTATIONS.index(surface_representation),
+        str(fn),
+    )
+    if status != 0:
+        raise OSError(f"Could not write surface cache file: {fn}.")
+
+
+def load_surface(
+    fn: Union[str, pathlib.Path] = "surface.serd"
+) -> Tuple[numpy.ndarray, numpy.ndarray, str, float, float]:
+    """Load solvent-exposed surface from a compressed binary cache file
+    written by `save_surface`.
+
+    Parameters
+    ----------
+    fn : Union[str, pathlib.Path], optional
+        A path to cache file, by default "surface.serd".
+
+    Returns
+    -------
+    surface : numpy.ndarray
+        Solvent-exposed surface points in the 3D grid (surface[nx, ny, nz]).
+    vertices : numpy.ndarray
+        A numpy.ndarray with xyz vertices coordinates
+        (origin, X-axis, Y-axis, Z-axis).
+    surface_representation : str
+        Surface representation of `surface`.
+    step : float
+        Grid spacing (A) of `surface`.
+    probe : float
+        Probe size (A) of `surface`.
+
+    Raises
+    ------
+    TypeError
+        `fn` must be a string or a pathlib.Path.
+    ValueError
+        `fn` is not a surface cache file.
+    """
+    from _SERD import _load_surface
+
+    # Check arguments types
+    if type(fn) not in [str, pathlib.Path]:
+        raise TypeError("`fn` must be a string or a pathlib.Path.")
+
+    # Read header
+    header = numpy.fromfile(fn, dtype=_CACHE_HEADER, count=1)
+    if len(header) != 1 or header["magic"][0] != b"SERD":
+        raise ValueError(f"`fn` is not a surface cache file: {fn}.")
+    header = header[0]
+    if not 0 <= header["representation"] < len(_REPRESENTATIONS):
+        raise ValueError(f"`fn` is not a surface cache file: {fn}.")
+
+    # Check grid units, whose voxels must fit in the runs of payload: each run
+    # takes a label and a length byte, the longest one the bytes left over
+    nx, ny, nz = (int(dim) for dim in header["dims"])
+    nruns = int(header["nruns"])
+    payload = os.path.getsize(fn) - _CACHE_HEADER.itemsize
+    if min(nx, ny, nz) <= 0 or nruns <= 0 or 2 * nruns > payload:
+        raise ValueError(f"`fn` is not a surface cache file: {fn}.")
+    nbytes = min(payload - 2 * nruns + 1, 10)
+    if nx * ny * nz > 2 ** (7 * nbytes) - 1 + (nruns - 1) * 0x7F:
+        raise ValueError(f"`fn` is not a surface cache file: {fn}.")
+
+    # Read surface
+    status, surface = _load_surface(str(fn))
+    if status != 0:
+        raise ValueError(f"`fn` is not a surface cache file: {fn}.")
+
+    return (
+        surface,
+        header["vertices"].copy(),
+        _REPRESENTATIONS[header["representation"]],
+        float(header["step"]),
+        float(header["probe"]),
+    )
+
+
 def save_session(
     target: Union[str, pathlib.Path],
     residues: List[List[str]],
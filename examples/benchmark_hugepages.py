@@ -0,0 +1,155 @@
+#!/usr/bin/env python
+"""Benchmark of huge-page allocation of the surface 3D grid.
+
+Defines the surface of a target biomolecule twice, each time in a fresh
+process: once with transparent huge pages and once with them disabled for the
+process (prctl PR_SET_THP_DISABLE). It reports the best surface time, the peak
+AnonHugePages of the process and, when `perf` is available, dTLB load misses.
+
+Usage
+-----
+$ python examples/benchmark_hugepages.py --step 0.1
+
+Note
+----
+Transparent huge pages must be enabled as `always` or `madvise` in
+/sys/kernel/mm/transparent_hugepage/enabled. dTLB events need `perf` and
+access to hardware counters (kernel.perf_event_paranoid <= 2).
+"""
+import argparse
+import ctypes
+import json
+import os
+import pathlib
+import shutil
+import subprocess
+import sys
+import time
+
+PR_SET_THP_DISABLE = 41
+EVENTS = "dTLB-loads,dTLB-load-misses"
+
+
+def run(args: argparse.Namespace):
+    """Defines the surface in this process and prints timings as JSON."""
+    if args.run == "base":
+        libc = ctypes.CDLL(None, use_errno=True)
+        if libc.prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) != 0:
+            raise OSError(ctypes.get_errno(), "Could not disable transparent huge pages.")
+
+    import SERD
+
+    atomic = SERD.read_pdb(args.target, SERD.read_vdw())
+    times = []
+    for _ in range(args.repeats):
+        start = time.perf_counter()
+        surface = SERD.surface(
+            atomic, step=args.step, probe=args.probe, nthreads=args.nthreads
+        )
+        times.append(time.perf_counter() - start)
+    print(json.dumps({"time": min(times), "voxels": int(surface.size)}), flush=True)
+
+
+def anon_huge_pages(pid: int) -> int:
+    """Gets AnonHugePages (kB) of a process, or 0 if it is gone."""
+    try:
+        with open(f"/proc/{pid}/smaps_rollup") as f:
+            for line in f:
+                if line.startswith("AnonHugePages:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return 0
+
+
+def python_pid(pid: int) -> int:
+    """Gets the benchmark process, below `perf` when it wraps it."""
+    try:
+        with open(f"/proc/{pid}/task/{pid}/children") as f:
+            children = f.read().split()
+    except OSError:
+        children = []
+    return int(children[0]) if children else pid
+
+
+def measure(mode: str, args: argparse.Namespace) -> dict:
+    """Runs the benchmark in a fresh process, sampling its AnonHugePages."""
+    cmd = [
+        sys.executable,
+        os.path.abspath(__file__),
+        "--run",
+        mode,
+        "--target",
+        str(args.target),
+        "--step",
+        str(args.step),
+        "--probe",
+        str(args.probe),
+        "--repeats",
+        str(args.repeats),
+    ]
+    if args.nthreads is not None:
+        cmd += ["--nthreads", str(args.nthreads)]
+    perf = shutil.which("perf")
+    if perf:
+        cmd = [perf, "stat", "-x", ",", "-e", EVENTS] + cmd
+
+    process = subprocess.Popen(
+        cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True
+    )
+    peak = 0
+    while process.poll() is None:
+        peak = max(peak, anon_huge_pages(python_pid(process.pid)))
+        time.sleep(0.005)
+    stdout, stderr = process.communicate()
+    if process.returncode != 0:
+        raise RuntimeError(f"Benchmark failed ({mode}):\n{stderr}")
+
+    result = json.loads(stdout.strip().splitlines()[-1])
+    result["AnonHugePages"] = peak
+    for line in stderr.splitlines():
+        fields = line.split(",")
+        if len(fields) > 2 and fields[2] in EVENTS.split(","):
+            result[fields[2]] = int(fields[0]) if fields[0].isdigit() else None
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--target",
+        type=pathlib.Path,
+        default=pathlib.Path(__file__).parent / "1FMO.pdb",
+        help="PDB file of target biomolecule (default: examples/1FMO.pdb)",
+    )
+    parser.add_argument("--step", type=float, default=0.1, help="grid spacing (A)")
+    parser.add_argument("--probe", type=float, default=1.4, help="probe size (A)")
+    parser.add_argument("--nthreads", type=int, default=None, help="number of threads")
+    parser.add_argument("--repeats", type=int, default=3, help="surface definitions")
+    parser.add_argument("--run", choices=["huge", "base"], help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.run is not None:
+        run(args)
+        return
+
+    results = {mode: measure(mode, args) for mode in ["huge", "base"]}
+    print(f"Target: {args.target}, step: {args.step} A, probe: {args.probe} A")
+    print(f"Grid: {results['huge']['voxels'] / 2**20:.1f} M voxels")
+    print(f"{'':24}{'huge pages':>14}{'base pages':>14}")
+    rows = [("time (s)", "time", "{:.3f}"), ("AnonHugePages (kB)", "AnonHugePages", "{:d}")]
+    rows += [(event, event, "{:d}") for event in EVENTS.split(",")]
+    for label, key, fmt in rows:
+        if key not in results["huge"]:
+            continue
+        values = [
+            fmt.format(results[mode][key]) if results[mode][key] is not None else "n/a"
+            for mode in ["huge", "base"]
+        ]
+        print(f"{label:24}{values[0]:>14}{values[1]:>14}")
+    if "dTLB-load-misses" not in results["huge"]:
+        print("perf not found: dTLB load misses not measured.")
+
+
+if __name__ == "__main__":
+    main()
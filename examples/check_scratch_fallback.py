@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+"""Regression check of the memory-mapped grid mode when its scratch file stops growing.
+
+Defines the surface of a target biomolecule with the brick pool backed by a
+scratch file, under a file size limit (RLIMIT_FSIZE) that lets the first
+brick pool chunks be mapped and makes the next ones fall back to heap memory,
+as on a full disk. The surface must match the in-memory surface, and the call
+must not crash when the brick pool is released.
+
+Usage
+-----
+$ python examples/check_scratch_fallback.py
+"""
+import argparse
+import os
+import pathlib
+import resource
+import sys
+import tempfile
+
+import numpy
+
+import SERD
+from _SERD import _mapped_surface
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--target",
+        type=pathlib.Path,
+        default=pathlib.Path(__file__).parent / "1FMO.pdb",
+        help="PDB file of target biomolecule (default: examples/1FMO.pdb)",
+    )
+    parser.add_argument("--step", type=float, default=0.3, help="grid spacing (A)")
+    parser.add_argument("--probe", type=float, default=1.4, help="probe size (A)")
+    parser.add_argument(
+        "--limit", type=int, default=3 * 2**20, help="scratch file size limit (bytes)"
+    )
+    parser.add_argument("--nthreads", type=int, default=None, help="number of threads")
+    args = parser.parse_args()
+    if args.nthreads is None:
+        args.nthreads = max(os.cpu_count() - 1, 1)
+
+    atomic = SERD.read_pdb(str(args.target), SERD.read_vdw())
+    expected = SERD.surface(atomic, "SES", args.step, args.probe, args.nthreads)
+
+    vertices = SERD.get_vertices(atomic, args.probe, args.step)
+    sincos = SERD._get_sincos(vertices)
+    nx, ny, nz = SERD._get_dimensions(vertices, args.step)
+    xyzr = atomic[:, 4:].astype(numpy.float64)
+
+    with tempfile.TemporaryDirectory() as scratch:
+        # Size the surface file before the limit, only the scratch file grows
+        mapped = numpy.memmap(
+            os.path.join(scratch, "surface.grid"),
+            dtype=numpy.int8,
+            mode="w+",
+            shape=(nx * ny * nz,),
+        )
+        limits = resource.getrlimit(resource.RLIMIT_FSIZE)
+        resource.setrlimit(resource.RLIMIT_FSIZE, (args.limit, limits[1]))
+        try:
+            status = _mapped_surface(
+                mapped,
+                nx,
+                ny,
+                nz,
+                xyzr,
+                vertices[0],
+                sincos,
+                args.step,
+                args.probe,
+                True,
+                0,
+                False,
+                scratch,
+                args.nthreads,
+                False,
+            )
+        finally:
+            resource.setrlimit(resource.RLIMIT_FSIZE, limits)
+        surface = numpy.array(mapped).reshape(nx, ny, nz)
+        del mapped
+
+    if status != 0:
+        print(f"FAILED: _mapped_surface returned {status}.")
+        sys.exit(1)
+    if surface.shape != expected.shape or (surface != expected).any():
+        print(f"FAILED: {int((surface != expected).sum())} points differ from in-memory surface.")
+        sys.exit(1)
+    print(f"OK: {surface.size} points match the in-memory surface.")
+
+
+if __name__ == "__main__":
+    main()